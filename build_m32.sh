@@ -25,7 +25,7 @@ mkdir -p bin lib32
 rm -f bin/lib32
 ln -sn ../lib32 bin/lib32
 gcc -c -O3 -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m32 -fPIC -I./include -o lib32/libmemorypa.o src/memorypa.c
-gcc -shared -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m32 -o lib32/libmemorypa.so lib32/libmemorypa.o -lc
+gcc -shared -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m32 -o lib32/libmemorypa.so lib32/libmemorypa.o -lpthread -lc
 printf "gcc -m32 ...\n"
 gcc -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m32 -Wl,-rpath,\$ORIGIN/lib32 -I./include src/test_memorypa.c -o bin/test_memorypa_c32 -L./lib32 -lmemorypa -lpthread
 gcc -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m32 -Wl,-rpath,\$ORIGIN/lib32 -I./include -DMEMORYPA_TEST_RESCUE src/test_memorypa.c -o bin/test_memorypa_rescue_c32 -L./lib32 -lmemorypa -lpthread
@@ -25,7 +25,7 @@ mkdir -p bin lib64
 rm -f bin/lib64
 ln -sn ../lib64 bin/lib64
 gcc -c -O3 -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m64 -fPIC -I./include -o lib64/libmemorypa.o src/memorypa.c
-gcc -shared -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m64 -o lib64/libmemorypa.so lib64/libmemorypa.o -lc
+gcc -shared -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m64 -o lib64/libmemorypa.so lib64/libmemorypa.o -lpthread -lc
 printf "gcc...\n"
 gcc -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m64 -Wl,-rpath,\$ORIGIN/lib64 -I./include src/test_memorypa.c -o bin/test_memorypa_c -L./lib64 -lmemorypa -lpthread
 gcc -std=c11 -Wpedantic -Wall -Wextra -Wpointer-arith -Werror=vla -m64 -Wl,-rpath,\$ORIGIN/lib64 -I./include -DMEMORYPA_TEST_RESCUE src/test_memorypa.c -o bin/test_memorypa_rescue_c -L./lib64 -lmemorypa -lpthread
@@ -23,13 +23,36 @@
 #include <intrin.h>
 #pragma intrinsic(_InterlockedOr8)
 #pragma intrinsic(_InterlockedAnd8)
+#pragma intrinsic(_InterlockedCompareExchange64)
+#pragma intrinsic(_InterlockedExchangeAdd)
+#pragma intrinsic(_InterlockedOr)
 #include <io.h>
+#include <fcntl.h>
 #else
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+// Stack traces for the sampling profiler:
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define MEMORYPA_BACKTRACE
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+// The CPU number is one load away in the restartable sequence that glibc registers:
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35)) && defined(__has_builtin)
+#if __has_builtin(__builtin_thread_pointer)
+#include <sys/rseq.h>
+#define MEMORYPA_RSEQ
+#endif
+#endif
+#endif
 #endif
 
 #include <stdlib.h>
@@ -49,9 +72,58 @@ extern "C" {
 #define MEMORYPA_FILENO fileno
 #endif
 
+#ifdef _MSC_VER
+#define MEMORYPA_THREAD_LOCAL __declspec(thread)
+#else
+#define MEMORYPA_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#endif
+
 #define MEMORYPA_WRITE_OPTION_STDOUT 0
 #define MEMORYPA_WRITE_OPTION_STDERR 1
 #define MEMORYPA_INITIALIZER_SLAB_SIZE 1024
+#define MEMORYPA_SYNCHRONIZATION_SPIN_LOCK 0
+#define MEMORYPA_SYNCHRONIZATION_LOCK_FREE 1
+#define MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK 2
+#define MEMORYPA_QUEUE_LOCK_SPINS 128
+#define MEMORYPA_CACHE_LINE_SIZE 64
+#define MEMORYPA_FREE_LIST_ARRAY 0
+#define MEMORYPA_FREE_LIST_INTRUSIVE 1
+#define MEMORYPA_ROUTE_TABLE_MAX_SIZE 4096
+#define MEMORYPA_ROUTE_TABLE_STEP_SHIFT 3
+#define MEMORYPA_ROUTE_TABLE_SIZE ((MEMORYPA_ROUTE_TABLE_MAX_SIZE >> MEMORYPA_ROUTE_TABLE_STEP_SHIFT) + 1)
+#define MEMORYPA_ROUTE_TABLE_STRADDLED 0xffff
+#define MEMORYPA_STEPS_MAX_SHIFT 3
+#define MEMORYPA_STEPS_MAX (1 << MEMORYPA_STEPS_MAX_SHIFT)
+#define MEMORYPA_NATIVE_ALIGNMENT 16
+#define MEMORYPA_ALIGNED_TABLE_POWER 10
+#define MEMORYPA_SEGMENTS_MAX 16
+#define MEMORYPA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define MEMORYPA_HUGE_PAGES_NONE 0
+#define MEMORYPA_HUGE_PAGES_EXPLICIT 1
+#define MEMORYPA_HUGE_PAGES_TRANSPARENT 2
+#define MEMORYPA_TRIM_DONTNEED 0
+#define MEMORYPA_TRIM_FREE 1
+#define MEMORYPA_MAPPING_THRESHOLD (128 * 1024)
+#define MEMORYPA_BATCH_SIZE 64
+#define MEMORYPA_ARENA_CHUNK_SIZE 65536
+#define MEMORYPA_CONFIG_SIZE 4096
+#define MEMORYPA_CONFIG_INLINE_VARIABLE "MEMORYPA_POOLS"
+#define MEMORYPA_CONFIG_FILE_VARIABLE "MEMORYPA_CONFIG"
+#define MEMORYPA_PROFILE_EXPORT_MAXIMA 0
+#define MEMORYPA_PROFILE_EXPORT_CONFIG 1
+#define MEMORYPA_PROFILE_EXPORT_C 2
+#define MEMORYPA_PROFILE_BUCKETS_SHIFT 5
+#define MEMORYPA_PROFILE_BUCKETS (1 << MEMORYPA_PROFILE_BUCKETS_SHIFT)
+#define MEMORYPA_PROFILE_SIZES 16
+#define MEMORYPA_PROFILE_SAMPLE_RATE (512 * 1024)
+#define MEMORYPA_PROFILE_SITES 4096
+#define MEMORYPA_PROFILE_DEPTH 32
+#define MEMORYPA_PROFILE_SPILL 16
+#define MEMORYPA_EVENTS_POWER 8
+#define MEMORYPA_EVENTS_SIZE (1 << MEMORYPA_EVENTS_POWER)
+#define MEMORYPA_EVENT_OUT_OF_MEMORY 1
+#define MEMORYPA_EVENT_NOT_INITIALIZED 2
+#define MEMORYPA_EVENT_RESCUED_REALLOC 3
 
 const size_t memorypa_one = 1;
 
@@ -59,38 +131,87 @@ typedef struct {
   void *(*malloc)(size_t);
   void *(*realloc)(void*,size_t);
   void (*free)(void*);
+  unsigned char profile_histogram;
+  unsigned char native_alignment;
+  unsigned char headerless;
+  unsigned char huge_pages;
+  unsigned char trim;
+  size_t trim_threshold;
+  size_t mapping_threshold;
+  size_t profile_sample_rate;
 } memorypa_functions;
 
 typedef struct {
   unsigned char power;
   size_t padding;
   size_t amount;
+  size_t cache;
+  unsigned char synchronization;
+  unsigned char free_list;
+  unsigned char prefetch;
+  unsigned char steps;
+  unsigned char exact;
+  unsigned char per_cpu;
+  unsigned char segments;
   size_t own_block_size;
   size_t own_size;
   size_t own_relative_position;
 } memorypa_pool_options;
 
+typedef struct {
+  unsigned char kind;
+  unsigned char site;
+  size_t size_class;
+  size_t size;
+} memorypa_event;
+
+typedef struct memorypa_heap memorypa_heap_t;
+
 int memorypa_write(int option, const void *buffer, unsigned int count);
 int memorypa_write_decimal(size_t number, unsigned int right_align, int write_option);
 int memorypa_write_hex(size_t number, unsigned int right_align, int write_option);
 int memorypa_write_message(const char *message, int write_option);
 unsigned char memorypa_initialize();
 unsigned char memorypa_pools_are_invalid();
+void memorypa_pools_print();
+size_t memorypa_trim(size_t keep_bytes);
+size_t memorypa_events_drain(memorypa_event *events, size_t amount);
+void memorypa_events_print();
 void memorypa_destroy();
+void memorypa_thread_cache_flush();
 size_t memorypa_get_size_t_size();
 size_t memorypa_get_size_t_bit_size();
 size_t memorypa_get_size_t_half_bit_size();
 size_t memorypa_get_u_char_bit_size();
+unsigned char memorypa_get_huge_pages();
 size_t memorypa_msb(size_t value);
 size_t memorypa_get_thread_id();
+size_t memorypa_get_cpu();
 size_t memorypa_mhash(size_t value);
 void * memorypa_malloc(size_t size);
+size_t memorypa_malloc_batch(size_t size, size_t amount, void **output);
 void * memorypa_aligned_malloc(size_t alignment, size_t size);
 void * memorypa_calloc(size_t amount, size_t unit_size);
 void * memorypa_aligned_calloc(size_t alignment, size_t amount, size_t unit_size);
 void * memorypa_realloc(void *data, size_t new_size);
+void * memorypa_realloc_sized(void *data, size_t size, size_t new_size);
 void * memorypa_aligned_realloc(void *data, size_t alignment, size_t new_size);
 void memorypa_free(void *data);
+void memorypa_free_sized(void *data, size_t size);
+void memorypa_free_batch(void **data, size_t amount);
+void * memorypa_arena_create(size_t chunk_size);
+void * memorypa_arena_malloc(void *arena, size_t size);
+void * memorypa_arena_aligned_malloc(void *arena, size_t alignment, size_t size);
+void * memorypa_arena_mark(void *arena);
+void memorypa_arena_rewind(void *arena, void *mark);
+void memorypa_arena_reset(void *arena);
+void memorypa_arena_destroy(void *arena);
+memorypa_heap_t * memorypa_heap_create(memorypa_pool_options *sets_of_pool_options);
+void * memorypa_heap_malloc(memorypa_heap_t *heap, size_t size);
+void * memorypa_heap_realloc(memorypa_heap_t *heap, void *data, size_t new_size);
+void memorypa_heap_free(memorypa_heap_t *heap, void *data);
+void memorypa_heap_reset(memorypa_heap_t *heap);
+void memorypa_heap_destroy(memorypa_heap_t *heap);
 size_t memorypa_malloc_usable_size(void *data);
 void * memorypa_profile_malloc(size_t size);
 void * memorypa_profile_aligned_malloc(size_t alignment, size_t size);
@@ -101,6 +222,9 @@ void * memorypa_profile_aligned_realloc(void *data, size_t alignment, size_t new
 void memorypa_profile_free(void *data);
 size_t memorypa_profile_malloc_usable_size(void *data);
 void memorypa_profile_print();
+int memorypa_profile_export(int fd, int format, size_t headroom, unsigned char solve);
+int memorypa_profile_merge(const char *path);
+int memorypa_profile_sites_export(int fd, size_t power, unsigned char peak);
 
 #ifndef _MSC_VER
 // Intended for overriding by the user (do not define within this library):
@@ -18,12 +18,29 @@
 #ifdef _MSC_VER
 #include <process.h>
 #else
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <pthread.h>
 #include <sys/time.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
 #endif
 
 #include "memorypa.h"
 
+static unsigned char benchmark_synchronization = MEMORYPA_SYNCHRONIZATION_SPIN_LOCK;
+static size_t benchmark_cache = 0;
+static size_t benchmark_scale = 1;
+static unsigned char benchmark_huge_pages = 0;
+static unsigned char benchmark_per_cpu = 0;
+static unsigned char benchmark_profile = 0;
+static size_t benchmark_trim_threshold = 0;
+static size_t benchmark_mapping_threshold = 0;
+static size_t benchmark_sample_rate = 0;
+
 #ifdef _MSC_VER
 __declspec(dllexport) void memorypa_initializer_options(memorypa_functions *functions, memorypa_pool_options *sets_of_pool_options) {
 #else
@@ -32,6 +49,10 @@ void memorypa_initializer_options(memorypa_functions *functions, memorypa_pool_o
   functions->malloc = malloc;
   functions->realloc = realloc;
   functions->free = free;
+  functions->huge_pages = benchmark_huge_pages;
+  functions->trim_threshold = benchmark_trim_threshold;
+  functions->mapping_threshold = benchmark_mapping_threshold;
+  functions->profile_sample_rate = benchmark_sample_rate;
   sets_of_pool_options[0].power = 11;
   sets_of_pool_options[0].amount = 100;
   sets_of_pool_options[1].power = 12;
@@ -48,6 +69,14 @@ void memorypa_initializer_options(memorypa_functions *functions, memorypa_pool_o
   sets_of_pool_options[6].amount = 560;
   sets_of_pool_options[7].power = 18;
   sets_of_pool_options[7].amount = 5;
+  size_t i = 0;
+  do {
+    sets_of_pool_options[i].synchronization = benchmark_synchronization;
+    sets_of_pool_options[i].cache = benchmark_cache;
+    sets_of_pool_options[i].per_cpu = benchmark_per_cpu;
+    sets_of_pool_options[i].amount *= benchmark_scale;
+  }
+  while(++i < 8);
 }
 
 static unsigned long long int ustime() {
@@ -176,7 +205,646 @@ static void * benchmark_first_thread(void * first_thread_data) {
   #endif
 }
 
-int main() {
+/*
+  The contention benchmark has every thread hammer the same pool with
+  back-to-back "malloc" and "free" calls, behind the spin lock, through
+  the lock-free free block stack, and behind the queue lock. The profile
+  benchmark does the same through the profiler instead.
+*/
+#define MEMORYPA_BENCHMARK_CONTENTION_OPERATIONS 1000000
+#define MEMORYPA_BENCHMARK_CONTENTION_THREADS_MAX 64
+
+#ifdef _MSC_VER
+static unsigned __stdcall benchmark_contention_thread(void * contention_thread_data) {
+#else
+static void * benchmark_contention_thread(void * contention_thread_data) {
+#endif
+  size_t operations = *((size_t *)contention_thread_data);
+  void *block;
+  size_t i = 0;
+  if(benchmark_profile) {
+    do {
+      block = memorypa_profile_malloc(1500);
+      *((volatile unsigned char *)block) = 1;
+      memorypa_profile_free(block);
+    }
+    while(++i < operations);
+  }
+  else {
+    do {
+      block = memorypa_malloc(1500);
+      *((volatile unsigned char *)block) = 1;
+      memorypa_free(block);
+    }
+    while(++i < operations);
+  }
+  #ifdef _MSC_VER
+  return 0;
+  #else
+  return NULL;
+  #endif
+}
+
+static void time_contention(unsigned char synchronization, size_t threads) {
+  #ifdef _MSC_VER
+  uintptr_t thread_handles[MEMORYPA_BENCHMARK_CONTENTION_THREADS_MAX];
+  #else
+  pthread_t thread_handles[MEMORYPA_BENCHMARK_CONTENTION_THREADS_MAX];
+  #endif
+  size_t operations = MEMORYPA_BENCHMARK_CONTENTION_OPERATIONS / threads;
+  benchmark_synchronization = synchronization;
+  memorypa_initialize();
+  unsigned long long int start = ustime();
+  size_t i = 0;
+  do {
+    #ifdef _MSC_VER
+    thread_handles[i] = _beginthreadex(NULL, 0, benchmark_contention_thread, &operations, 0, NULL);
+    if(!thread_handles[i]) {
+    #else
+    if(pthread_create(&thread_handles[i], NULL, benchmark_contention_thread, &operations)) {
+    #endif
+      fprintf(stderr, "Failed to set up a contention thread!\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  while(++i < threads);
+  i = 0;
+  do {
+    #ifdef _MSC_VER
+    if(WaitForSingleObject((HANDLE)thread_handles[i], INFINITE) != WAIT_OBJECT_0) {
+    #else
+    if(pthread_join(thread_handles[i], NULL)) {
+    #endif
+      fprintf(stderr, "Failed to wait for a contention thread!\n");
+      exit(EXIT_FAILURE);
+    }
+    #ifdef _MSC_VER
+    CloseHandle((HANDLE)thread_handles[i]);
+    #endif
+  }
+  while(++i < threads);
+  unsigned long long int elapsed = ustime() - start;
+  memorypa_destroy();
+  const char *name = "spin lock";
+  if(benchmark_profile) {
+    name = "profile";
+  }
+  else if(benchmark_per_cpu) {
+    name = "per-CPU";
+  }
+  else if(synchronization == MEMORYPA_SYNCHRONIZATION_LOCK_FREE) {
+    name = "lock-free";
+  }
+  else if(synchronization == MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK) {
+    name = "queue lock";
+  }
+  printf(
+    "%10s, %2zu threads: %lluus, %llu operations per second\n",
+    name,
+    threads, elapsed,
+    elapsed ? (unsigned long long int)(operations * threads) * 1000000ull / elapsed : 0ull
+  );
+}
+
+static void time_profile() {
+  size_t threads = 1;
+  benchmark_profile = 1;
+  do {
+    time_contention(MEMORYPA_SYNCHRONIZATION_SPIN_LOCK, threads);
+  }
+  while((threads <<= 1) <= MEMORYPA_BENCHMARK_CONTENTION_THREADS_MAX);
+  benchmark_profile = 0;
+  printf("Done!\n\n");
+}
+
+static void time_contentions() {
+  size_t threads = 1;
+  do {
+    time_contention(MEMORYPA_SYNCHRONIZATION_SPIN_LOCK, threads);
+    time_contention(MEMORYPA_SYNCHRONIZATION_LOCK_FREE, threads);
+    time_contention(MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK, threads);
+    benchmark_per_cpu = 1;
+    time_contention(MEMORYPA_SYNCHRONIZATION_SPIN_LOCK, threads);
+    benchmark_per_cpu = 0;
+  }
+  while((threads <<= 1) <= MEMORYPA_BENCHMARK_CONTENTION_THREADS_MAX);
+  printf("Done!\n\n");
+}
+
+/*
+  The routing benchmark times back-to-back "malloc" and "free" calls of
+  random sizes on a single thread. Thread caches keep the pools' locks out
+  of the picture, so what's left is mostly the cost of finding the right
+  pool. Small sizes go through the routing table, larger sizes through the
+  MSB calculation.
+*/
+#define MEMORYPA_BENCHMARK_ROUTING_OPERATIONS 20000000
+#define MEMORYPA_BENCHMARK_ROUTING_SIZES_COUNT 1024
+
+static void time_routing_range(size_t minimum, size_t maximum) {
+  size_t sizes[MEMORYPA_BENCHMARK_ROUTING_SIZES_COUNT];
+  size_t i = 0;
+  do {
+    sizes[i] = minimum + ((size_t)rand() * MEMORYPA_BENCHMARK_ROUTING_SIZES_COUNT + i) % (maximum - minimum + 1);
+  }
+  while(++i < MEMORYPA_BENCHMARK_ROUTING_SIZES_COUNT);
+  void *block;
+  unsigned long long int start = ustime();
+  i = 0;
+  do {
+    block = memorypa_malloc(sizes[i & (MEMORYPA_BENCHMARK_ROUTING_SIZES_COUNT - 1)]);
+    memorypa_free(block);
+  }
+  while(++i < MEMORYPA_BENCHMARK_ROUTING_OPERATIONS);
+  unsigned long long int elapsed = ustime() - start;
+  printf(
+    "sizes %6zu to %6zu: %lluus, %.2fns per malloc and free\n",
+    minimum, maximum, elapsed,
+    (double)elapsed * 1000.0 / MEMORYPA_BENCHMARK_ROUTING_OPERATIONS
+  );
+}
+
+static void time_routing() {
+  benchmark_cache = 16;
+  memorypa_initialize();
+  srand((unsigned int)(ustime()));
+  time_routing_range(1, 4096);
+  time_routing_range(4097, 262143);
+  memorypa_destroy();
+  printf("Done!\n\n");
+}
+
+/*
+  The startup benchmark times the very first "malloc", which initializes
+  every pool, with the usual pools and with 16 times as many blocks in
+  each. Pools are carved lazily, so both should take about as long.
+*/
+static void time_startup_scale(size_t scale) {
+  benchmark_scale = scale;
+  unsigned long long int start = ustime();
+  void *block = memorypa_malloc(100);
+  unsigned long long int elapsed = ustime() - start;
+  memorypa_free(block);
+  memorypa_destroy();
+  printf("%2zux the blocks: %lluus to the first malloc\n", scale, elapsed);
+}
+
+static void time_startup() {
+  time_startup_scale(1);
+  time_startup_scale(16);
+  benchmark_scale = 1;
+  printf("Done!\n\n");
+}
+
+/*
+  The huge pages benchmark reads single bytes at random from every block
+  of the pool of power 17 (560 blocks, about 70 MiB), first on regular
+  pages, then on huge pages if the system has any. Where Linux lets us,
+  it also counts the misses of the data TLB.
+*/
+#define MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCKS 560
+#define MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCK_SIZE 100000
+#define MEMORYPA_BENCHMARK_HUGE_PAGES_READS 50000000
+
+static int dtlb_misses_open() {
+  #ifdef __linux__
+  struct perf_event_attr attributes;
+  memset(&attributes, 0, sizeof(attributes));
+  attributes.type = PERF_TYPE_HW_CACHE;
+  attributes.size = sizeof(attributes);
+  attributes.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attributes.disabled = 1;
+  attributes.exclude_kernel = 1;
+  attributes.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+  #else
+  return -1;
+  #endif
+}
+
+static void time_huge_pages_setting(unsigned char huge_pages) {
+  benchmark_huge_pages = huge_pages;
+  unsigned char *blocks[MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCKS];
+  size_t i = 0;
+  do {
+    blocks[i] = (unsigned char *)memorypa_malloc(MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCK_SIZE);
+    // Fault every page in before timing anything:
+    memset(blocks[i], (int)i, MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCK_SIZE);
+  }
+  while(++i < MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCKS);
+  const char *name = "regular pages";
+  if(memorypa_get_huge_pages() == MEMORYPA_HUGE_PAGES_EXPLICIT) {
+    name = "explicit huge pages";
+  }
+  else if(memorypa_get_huge_pages() == MEMORYPA_HUGE_PAGES_TRANSPARENT) {
+    name = "transparent huge pages";
+  }
+  int dtlb_misses = dtlb_misses_open();
+  unsigned long long int misses = 0;
+  #ifdef __linux__
+  if(dtlb_misses >= 0) {
+    ioctl(dtlb_misses, PERF_EVENT_IOC_RESET, 0);
+    ioctl(dtlb_misses, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  #endif
+  unsigned long long int random = 88172645463325252ull;
+  size_t sum = 0;
+  unsigned long long int start = ustime();
+  i = 0;
+  do {
+    random = random * 6364136223846793005ull + 1442695040888963407ull;
+    sum += blocks[(random >> 8) % MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCKS][(random >> 24) % MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCK_SIZE];
+  }
+  while(++i < MEMORYPA_BENCHMARK_HUGE_PAGES_READS);
+  unsigned long long int elapsed = ustime() - start;
+  #ifdef __linux__
+  if(dtlb_misses >= 0) {
+    ioctl(dtlb_misses, PERF_EVENT_IOC_DISABLE, 0);
+    if(read(dtlb_misses, &misses, sizeof(misses)) != (ssize_t)sizeof(misses)) {
+      misses = 0;
+    }
+    close(dtlb_misses);
+  }
+  #endif
+  i = 0;
+  do {
+    memorypa_free(blocks[i]);
+  }
+  while(++i < MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCKS);
+  memorypa_destroy();
+  printf(
+    "%22s: %lluus, %.2fns per read, ",
+    name, elapsed,
+    (double)elapsed * 1000.0 / MEMORYPA_BENCHMARK_HUGE_PAGES_READS
+  );
+  if(dtlb_misses >= 0) {
+    printf("%llu dTLB misses (checksum %zu)\n", misses, sum & 0xff);
+  }
+  else {
+    printf("dTLB misses unavailable (checksum %zu)\n", sum & 0xff);
+  }
+}
+
+static void time_huge_pages() {
+  time_huge_pages_setting(0);
+  time_huge_pages_setting(1);
+  benchmark_huge_pages = 0;
+  printf("Done!\n\n");
+}
+
+/*
+  The trim benchmark fills every block of the pool of power 17 (about 70
+  MiB), frees them all, and reports the resident set size before and
+  after "memorypa_trim", then again once the blocks are filled anew.
+  Afterwards it does the same with an automatic threshold of 8 MiB.
+*/
+#define MEMORYPA_BENCHMARK_TRIM_THRESHOLD (8 * 1024 * 1024)
+
+static size_t resident_size() {
+  size_t output = 0;
+  #ifdef __linux__
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if(statm != NULL) {
+    size_t total;
+    if(fscanf(statm, "%zu %zu", &total, &output) != 2) {
+      output = 0;
+    }
+    fclose(statm);
+  }
+  output *= (size_t)sysconf(_SC_PAGESIZE);
+  #endif
+  return output;
+}
+
+static void fill_trim_blocks(unsigned char **blocks) {
+  size_t i = 0;
+  do {
+    blocks[i] = (unsigned char *)memorypa_malloc(MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCK_SIZE);
+    memset(blocks[i], (int)i, MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCK_SIZE);
+  }
+  while(++i < MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCKS);
+}
+
+static void free_trim_blocks(unsigned char **blocks) {
+  size_t i = 0;
+  do {
+    memorypa_free(blocks[i]);
+  }
+  while(++i < MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCKS);
+}
+
+static void time_trim() {
+  unsigned char *blocks[MEMORYPA_BENCHMARK_HUGE_PAGES_BLOCKS];
+  memorypa_initialize();
+  printf("%24s: %6zu KiB\n", "initialized", resident_size() >> 10);
+  fill_trim_blocks(blocks);
+  printf("%24s: %6zu KiB\n", "filled", resident_size() >> 10);
+  free_trim_blocks(blocks);
+  printf("%24s: %6zu KiB\n", "freed", resident_size() >> 10);
+  unsigned long long int start = ustime();
+  size_t trimmed = memorypa_trim(0);
+  unsigned long long int elapsed = ustime() - start;
+  printf("%24s: %6zu KiB (%zu KiB trimmed in %lluus)\n", "trimmed", resident_size() >> 10, trimmed >> 10, elapsed);
+  start = ustime();
+  fill_trim_blocks(blocks);
+  elapsed = ustime() - start;
+  printf("%24s: %6zu KiB (%lluus to fill)\n", "filled again", resident_size() >> 10, elapsed);
+  free_trim_blocks(blocks);
+  memorypa_destroy();
+  benchmark_trim_threshold = MEMORYPA_BENCHMARK_TRIM_THRESHOLD;
+  memorypa_initialize();
+  fill_trim_blocks(blocks);
+  printf("%24s: %6zu KiB\n", "filled with a threshold", resident_size() >> 10);
+  start = ustime();
+  free_trim_blocks(blocks);
+  elapsed = ustime() - start;
+  printf("%24s: %6zu KiB (%lluus to free)\n", "freed with a threshold", resident_size() >> 10, elapsed);
+  memorypa_destroy();
+  benchmark_trim_threshold = 0;
+  printf("Done!\n\n");
+}
+
+/*
+  The mapping benchmark grows a buffer from 1 MiB to 512 MiB by doubling
+  it with "memorypa_realloc", touching every new page, first with its own
+  mapping and then through the given "realloc".
+*/
+#define MEMORYPA_BENCHMARK_MAPPING_MIN (1024 * 1024)
+#define MEMORYPA_BENCHMARK_MAPPING_MAX (512 * 1024 * 1024)
+
+static void time_mapping_threshold(size_t threshold) {
+  benchmark_mapping_threshold = threshold;
+  size_t size = MEMORYPA_BENCHMARK_MAPPING_MIN;
+  unsigned char *data = (unsigned char *)memorypa_malloc(size);
+  memset(data, 1, size);
+  unsigned long long int realloc_elapsed = 0;
+  unsigned long long int start;
+  while(data != NULL && size < MEMORYPA_BENCHMARK_MAPPING_MAX) {
+    start = ustime();
+    data = (unsigned char *)memorypa_realloc(data, size << 1);
+    realloc_elapsed += ustime() - start;
+    if(data != NULL) {
+      memset(data + size, 1, size);
+      size <<= 1;
+    }
+  }
+  memorypa_free(data);
+  memorypa_destroy();
+  printf("%22s: %lluus in realloc up to %zu MiB\n", threshold == (size_t)-1 ? "given realloc" : "own mappings", realloc_elapsed, size >> 20);
+}
+
+static void time_mapping() {
+  time_mapping_threshold(0);
+  time_mapping_threshold((size_t)-1);
+  benchmark_mapping_threshold = 0;
+  printf("Done!\n\n");
+}
+
+/*
+  The batch benchmark allocates and frees 64 buffers of 1500 bytes at a
+  time, first one by one and then with the batch functions.
+*/
+#define MEMORYPA_BENCHMARK_BATCH_SIZE 64
+#define MEMORYPA_BENCHMARK_BATCH_ROUNDS 200000
+
+static void time_batch() {
+  void *data[MEMORYPA_BENCHMARK_BATCH_SIZE];
+  size_t i, j;
+  memorypa_initialize();
+  unsigned long long int start = ustime();
+  i = 0;
+  do {
+    j = 0;
+    do {
+      data[j] = memorypa_malloc(1500);
+    }
+    while(++j < MEMORYPA_BENCHMARK_BATCH_SIZE);
+    j = 0;
+    do {
+      memorypa_free(data[j]);
+    }
+    while(++j < MEMORYPA_BENCHMARK_BATCH_SIZE);
+  }
+  while(++i < MEMORYPA_BENCHMARK_BATCH_ROUNDS);
+  unsigned long long int single_elapsed = ustime() - start;
+  start = ustime();
+  i = 0;
+  do {
+    memorypa_malloc_batch(1500, MEMORYPA_BENCHMARK_BATCH_SIZE, data);
+    memorypa_free_batch(data, MEMORYPA_BENCHMARK_BATCH_SIZE);
+  }
+  while(++i < MEMORYPA_BENCHMARK_BATCH_ROUNDS);
+  unsigned long long int batch_elapsed = ustime() - start;
+  memorypa_destroy();
+  printf(
+    "one by one: %lluus (%.2fns per buffer)\n"
+    "   batches: %lluus (%.2fns per buffer)\n",
+    single_elapsed, (double)single_elapsed * 1000.0 / (MEMORYPA_BENCHMARK_BATCH_ROUNDS * MEMORYPA_BENCHMARK_BATCH_SIZE),
+    batch_elapsed, (double)batch_elapsed * 1000.0 / (MEMORYPA_BENCHMARK_BATCH_ROUNDS * MEMORYPA_BENCHMARK_BATCH_SIZE)
+  );
+  printf("Done!\n\n");
+}
+
+/*
+  The sized benchmark frees 512 buffers of 100000 bytes in a scattered
+  order, first with "memorypa_free" and then with "memorypa_free_sized".
+*/
+#define MEMORYPA_BENCHMARK_SIZED_AMOUNT 512
+#define MEMORYPA_BENCHMARK_SIZED_ROUNDS 20000
+
+static void time_sized() {
+  void **data = (void **)malloc(sizeof(void *) * MEMORYPA_BENCHMARK_SIZED_AMOUNT);
+  if(data == NULL) {
+    fprintf(stderr, "Failed to allocate the sized benchmark!\n");
+    exit(EXIT_FAILURE);
+  }
+  unsigned long long int elapsed[2] = {0, 0};
+  size_t i, j, k;
+  memorypa_initialize();
+  i = 0;
+  do {
+    k = 0;
+    do {
+      j = 0;
+      do {
+        data[j] = memorypa_malloc(100000);
+      }
+      while(++j < MEMORYPA_BENCHMARK_SIZED_AMOUNT);
+      // An odd stride visits every buffer once, far from the last one:
+      unsigned long long int start = ustime();
+      j = 0;
+      if(k) {
+        do {
+          memorypa_free_sized(data[(j * 40503) & (MEMORYPA_BENCHMARK_SIZED_AMOUNT - 1)], 100000);
+        }
+        while(++j < MEMORYPA_BENCHMARK_SIZED_AMOUNT);
+      }
+      else {
+        do {
+          memorypa_free(data[(j * 40503) & (MEMORYPA_BENCHMARK_SIZED_AMOUNT - 1)]);
+        }
+        while(++j < MEMORYPA_BENCHMARK_SIZED_AMOUNT);
+      }
+      elapsed[k] += ustime() - start;
+    }
+    while(++k < 2);
+  }
+  while(++i < MEMORYPA_BENCHMARK_SIZED_ROUNDS);
+  memorypa_destroy();
+  free(data);
+  printf(
+    "      free: %lluus (%.2fns per buffer)\n"
+    "free_sized: %lluus (%.2fns per buffer)\n",
+    elapsed[0], (double)elapsed[0] * 1000.0 / ((double)MEMORYPA_BENCHMARK_SIZED_ROUNDS * MEMORYPA_BENCHMARK_SIZED_AMOUNT),
+    elapsed[1], (double)elapsed[1] * 1000.0 / ((double)MEMORYPA_BENCHMARK_SIZED_ROUNDS * MEMORYPA_BENCHMARK_SIZED_AMOUNT)
+  );
+  printf("Done!\n\n");
+}
+
+/*
+  The arena benchmark builds 64 objects of 48 bytes and throws them
+  all away, first through "memorypa_malloc" and "memorypa_free" and then
+  through an arena that's reset each round.
+*/
+#define MEMORYPA_BENCHMARK_ARENA_AMOUNT 64
+#define MEMORYPA_BENCHMARK_ARENA_ROUNDS 200000
+
+static void time_arena() {
+  void **data = (void **)malloc(sizeof(void *) * MEMORYPA_BENCHMARK_ARENA_AMOUNT);
+  if(data == NULL) {
+    fprintf(stderr, "Failed to allocate the arena benchmark!\n");
+    exit(EXIT_FAILURE);
+  }
+  size_t i, j;
+  memorypa_initialize();
+  unsigned long long int start = ustime();
+  i = 0;
+  do {
+    j = 0;
+    do {
+      data[j] = memorypa_malloc(48);
+    }
+    while(++j < MEMORYPA_BENCHMARK_ARENA_AMOUNT);
+    j = 0;
+    do {
+      memorypa_free(data[j]);
+    }
+    while(++j < MEMORYPA_BENCHMARK_ARENA_AMOUNT);
+  }
+  while(++i < MEMORYPA_BENCHMARK_ARENA_ROUNDS);
+  unsigned long long int single_elapsed = ustime() - start;
+  void *arena = memorypa_arena_create(0);
+  start = ustime();
+  i = 0;
+  do {
+    j = 0;
+    do {
+      data[j] = memorypa_arena_malloc(arena, 48);
+    }
+    while(++j < MEMORYPA_BENCHMARK_ARENA_AMOUNT);
+    memorypa_arena_reset(arena);
+  }
+  while(++i < MEMORYPA_BENCHMARK_ARENA_ROUNDS);
+  unsigned long long int arena_elapsed = ustime() - start;
+  memorypa_arena_destroy(arena);
+  memorypa_destroy();
+  free(data);
+  printf(
+    "one by one: %lluus (%.2fns per object)\n"
+    "     arena: %lluus (%.2fns per object)\n",
+    single_elapsed, (double)single_elapsed * 1000.0 / ((double)MEMORYPA_BENCHMARK_ARENA_ROUNDS * MEMORYPA_BENCHMARK_ARENA_AMOUNT),
+    arena_elapsed, (double)arena_elapsed * 1000.0 / ((double)MEMORYPA_BENCHMARK_ARENA_ROUNDS * MEMORYPA_BENCHMARK_ARENA_AMOUNT)
+  );
+  printf("Done!\n\n");
+}
+
+/*
+  The sampling benchmark allocates and frees 64 profiled buffers of 16 to
+  4096 bytes at a time, without sampling, at the default sampling rate,
+  and at a sample every 4 KiB or so.
+*/
+#define MEMORYPA_BENCHMARK_SAMPLING_SIZE 64
+#define MEMORYPA_BENCHMARK_SAMPLING_ROUNDS 100000
+
+static void time_sampling_rate(size_t rate) {
+  void *data[MEMORYPA_BENCHMARK_SAMPLING_SIZE];
+  size_t i, j;
+  benchmark_sample_rate = rate;
+  memorypa_initialize();
+  unsigned long long int start = ustime();
+  i = 0;
+  do {
+    j = 0;
+    do {
+      data[j] = memorypa_profile_malloc(16 << (j & 7));
+    }
+    while(++j < MEMORYPA_BENCHMARK_SAMPLING_SIZE);
+    j = 0;
+    do {
+      memorypa_profile_free(data[j]);
+    }
+    while(++j < MEMORYPA_BENCHMARK_SAMPLING_SIZE);
+  }
+  while(++i < MEMORYPA_BENCHMARK_SAMPLING_ROUNDS);
+  unsigned long long int elapsed = ustime() - start;
+  memorypa_destroy();
+  printf("%12zu: %lluus (%.2fns per object)\n", rate, elapsed, (double)elapsed * 1000.0 / ((double)MEMORYPA_BENCHMARK_SAMPLING_ROUNDS * MEMORYPA_BENCHMARK_SAMPLING_SIZE));
+}
+
+static void time_sampling() {
+  printf("Sampling rate in bytes (0 is off):\n");
+  time_sampling_rate(0);
+  time_sampling_rate(MEMORYPA_PROFILE_SAMPLE_RATE);
+  time_sampling_rate(4096);
+  benchmark_sample_rate = 0;
+  printf("Done!\n\n");
+}
+
+int main(int argc, char const *argv[]) {
+  if(argc > 1 && !strcmp(argv[1], "contention")) {
+    time_contentions();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "profile")) {
+    time_profile();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "routing")) {
+    time_routing();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "startup")) {
+    time_startup();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "huge_pages")) {
+    time_huge_pages();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "trim")) {
+    time_trim();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "mapping")) {
+    time_mapping();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "batch")) {
+    time_batch();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "sized")) {
+    time_sized();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "arena")) {
+    time_arena();
+    return 0;
+  }
+  if(argc > 1 && !strcmp(argv[1], "sampling")) {
+    time_sampling();
+    return 0;
+  }
   memorypa_initialize();
   #ifdef _MSC_VER
   uintptr_t first_thread_handle = _beginthreadex(NULL, 0, benchmark_first_thread, NULL, 0, NULL);
@@ -33,6 +33,12 @@ void memorypa_initializer_options(memorypa_functions *functions, memorypa_pool_o
   functions->malloc = malloc;
   functions->realloc = realloc;
   functions->free = free;
+  /*
+    Also count every profiled allocation by its exact size, so that
+    "memorypa_profile_print" can show how the sizes spread within each
+    power and suggest paddings.
+  */
+  functions->profile_histogram = 1;
   /*
     Since we're only profiling, the only thing that needs to be configured
     (if at all) is padding. Padding increases the size of the given power
@@ -80,6 +86,16 @@ int main() {
   // Print the profile:
   memorypa_profile_print();
   //
+  /*
+    Or turn it into pools, with 25% more blocks than the profile ever
+    needed. The first line can be handed to "MEMORYPA_POOLS" as is, and the
+    rest pasted into "memorypa_initializer_options". The solver (the last
+    argument) lets small powers share the pool of a larger one whenever
+    that reserves less memory overall.
+  */
+  memorypa_profile_export(MEMORYPA_FILENO(stdout), MEMORYPA_PROFILE_EXPORT_CONFIG, 25, 1);
+  memorypa_profile_export(MEMORYPA_FILENO(stdout), MEMORYPA_PROFILE_EXPORT_C, 25, 1);
+  //
   memorypa_destroy();
   return 0;
 }
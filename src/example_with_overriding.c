@@ -58,6 +58,11 @@ void memorypa_initializer_options(memorypa_functions *functions, memorypa_pool_o
   *(void **)(&(functions->realloc)) = dlsym(RTLD_NEXT, "realloc");
   *(void **)(&(functions->free)) = dlsym(RTLD_NEXT, "free");
   #endif
+  /*
+    Libraries that store doubles, atomics, or vectors in what "malloc"
+    returns expect it to be aligned for any type:
+  */
+  functions->native_alignment = 1;
   // See "example_standard.c":
   sets_of_pool_options[0].power = 7;
   sets_of_pool_options[0].amount = 500;
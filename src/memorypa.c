@@ -34,28 +34,115 @@ static size_t memorypa_size_t_bit_size = 0;
 static size_t memorypa_size_t_half_bit_size = 0;
 static size_t memorypa_size_t_half_bit_size_next_power = 0;
 static size_t memorypa_u_char_p_size = 0;
+static size_t memorypa_u_int_size = 0;
+static size_t memorypa_u_long_long_size = 0;
 
 static size_t memorypa_2st = 0;
-static size_t memorypa_1uc_4st_1ucp = 0;
 static size_t memorypa_1ucp_2uc = 0;
-static size_t memorypa_1uc_1st = 0;
-static size_t memorypa_1uc_2st = 0;
-static size_t memorypa_1uc_3st = 0;
-static size_t memorypa_1uc_4st = 0;
+static size_t memorypa_1ull = 0;
+static size_t memorypa_1ull_1st = 0;
+static size_t memorypa_1ull_1st_1ucp = 0;
+static size_t memorypa_1ull_1st_1ucp_3ui = 0;
+static size_t memorypa_1ull_1st_1ucp_3ui_1uc = 0;
+static size_t memorypa_1ull_1st_1ucp_4ui = 0;
+static size_t memorypa_1ull_1st_1ucp_4ui_1ull = 0;
+static size_t memorypa_1ull_1st_1ucp_4ui_1ull_1ucp = 0;
+static size_t memorypa_1cl = 0;
+static size_t memorypa_1cl_1st = 0;
+static size_t memorypa_1cl_2st = 0;
+static size_t memorypa_1cl_3st = 0;
+static size_t memorypa_1cl_4st = 0;
+static size_t memorypa_1cl_5st = 0;
+static size_t memorypa_1cl_6st = 0;
+static size_t memorypa_1cl_6st_1ucp = 0;
+static size_t memorypa_1cl_6st_1ucp_1uc = 0;
+static size_t memorypa_1cl_6st_1ucp_2uc = 0;
+static size_t memorypa_1cl_6st_1ucp_3uc = 0;
+static size_t memorypa_1cl_6st_1ucp_4uc = 0;
+static size_t memorypa_2cl = 0;
 static size_t memorypa_2uc = 0;
-static size_t memorypa_1ucp_1uc = 0;
 static size_t memorypa_1st_2uc = 0;
-static size_t memorypa_1st_1uc = 0;
+static size_t memorypa_1st_1ucp = 0;
+static size_t memorypa_block_alignment = 1;
+static size_t memorypa_block_header_size = 0;
+static size_t memorypa_profile_header_size = 0;
+static unsigned char memorypa_headerless = 0;
 
 static size_t memorypa_mhash_first_magic = 0;
 static size_t memorypa_mhash_second_magic = 0;
 static size_t memorypa_everything_size = 0;
+static unsigned char *memorypa_everything_given = NULL;
 static unsigned char *memorypa_everything = NULL;
+static unsigned char memorypa_huge_pages_requested = 0;
+static unsigned char memorypa_huge_pages = MEMORYPA_HUGE_PAGES_NONE;
+static size_t memorypa_everything_mapped_size = 0;
+static size_t memorypa_page_size = 4096;
+static unsigned char memorypa_trim_advice = MEMORYPA_TRIM_DONTNEED;
+static size_t memorypa_trim_threshold = 0;
+static size_t memorypa_mapping_threshold = MEMORYPA_MAPPING_THRESHOLD;
+static size_t memorypa_mapping_header_size = 0;
+static unsigned char memorypa_mapped_pool = 0;
+static size_t memorypa_arena_chunk_header_size = 0;
+static size_t memorypa_arena_header_size = 0;
 static size_t memorypa_profile_list_size = 0;
+static size_t memorypa_profile_shards_offset = 0;
+static size_t memorypa_profile_shard_size = 0;
 static unsigned char *memorypa_profile_list = NULL;
-static size_t memorypa_pool_list_size = 0;
-static unsigned char **memorypa_pool_list = NULL;
-static unsigned char memorypa_profile_lock = 0;
+static size_t memorypa_class_list_size = 0;
+static unsigned char *memorypa_class_list = NULL;
+static size_t memorypa_class_count = 0;
+static size_t memorypa_aligned_table_size = 0;
+static unsigned char *memorypa_aligned_table = NULL;
+static unsigned char memorypa_aligned_table_lock = 0;
+static size_t memorypa_pools_offset = 0;
+static unsigned short memorypa_class_cells[((sizeof(size_t) * CHAR_BIT) - MEMORYPA_STEPS_MAX_SHIFT + 1) << MEMORYPA_STEPS_MAX_SHIFT];
+static unsigned short memorypa_route_table[MEMORYPA_ROUTE_TABLE_SIZE];
+static size_t memorypa_profile_maxima[(sizeof(size_t) * CHAR_BIT) + 1];
+static unsigned char memorypa_profile_histogram = 0;
+static size_t memorypa_profile_buckets[((sizeof(size_t) * CHAR_BIT) + 1) << MEMORYPA_PROFILE_BUCKETS_SHIFT];
+static size_t memorypa_profile_sizes[((sizeof(size_t) * CHAR_BIT) + 1) * (MEMORYPA_PROFILE_SIZES << 1)];
+static size_t memorypa_generation = 0;
+static size_t memorypa_thread_cache_size = 0;
+static unsigned char memorypa_thread_cache_key_created = 0;
+static size_t memorypa_cpu_count = 1;
+static size_t memorypa_cpu_online_count = 1;
+static size_t memorypa_cpu_caches_size = 0;
+static unsigned char *memorypa_cpu_caches = NULL;
+static size_t memorypa_rescue_list_size = 0;
+static unsigned char *memorypa_rescue_list = NULL;
+static size_t memorypa_profile_sample_rate = 0;
+static size_t memorypa_profile_sample_threads = 0;
+static size_t memorypa_profile_site_size = 0;
+static size_t memorypa_profile_site_list_size = 0;
+static unsigned char *memorypa_profile_site_list = NULL;
+static size_t memorypa_events[MEMORYPA_EVENTS_SIZE << 2];
+static size_t memorypa_events_head = 0;
+static size_t memorypa_events_tail = 0;
+static size_t memorypa_events_dropped = 0;
+static size_t memorypa_events_rescued = 0;
+static unsigned char memorypa_events_lock = 0;
+static const unsigned char memorypa_event_kinds[9] = {
+  0,
+  MEMORYPA_EVENT_OUT_OF_MEMORY,
+  MEMORYPA_EVENT_NOT_INITIALIZED,
+  MEMORYPA_EVENT_RESCUED_REALLOC,
+  MEMORYPA_EVENT_NOT_INITIALIZED,
+  MEMORYPA_EVENT_OUT_OF_MEMORY,
+  MEMORYPA_EVENT_RESCUED_REALLOC,
+  MEMORYPA_EVENT_NOT_INITIALIZED,
+  MEMORYPA_EVENT_OUT_OF_MEMORY
+};
+#ifdef _MSC_VER
+static DWORD memorypa_thread_cache_key = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t memorypa_thread_cache_key;
+#endif
+
+static MEMORYPA_THREAD_LOCAL unsigned char *memorypa_thread_cache = NULL;
+static MEMORYPA_THREAD_LOCAL size_t memorypa_thread_cache_generation = 0;
+static MEMORYPA_THREAD_LOCAL unsigned char memorypa_thread_cache_unavailable = 0;
+static MEMORYPA_THREAD_LOCAL size_t memorypa_profile_sample_countdown = 0;
+static MEMORYPA_THREAD_LOCAL unsigned long long memorypa_profile_sample_state = 0;
 
 static inline size_t memorypa_own_get_thread_id() {
   #ifdef _MSC_VER
@@ -65,6 +152,31 @@ static inline size_t memorypa_own_get_thread_id() {
   #endif
 }
 
+/*
+  Restartable sequences keep the current CPU number in a per-thread area
+  that the kernel refreshes whenever the thread migrates, so reading it
+  costs a single load. Without them, fall back to "sched_getcpu". The
+  number may be stale by the time it's used, which only costs a little
+  contention on a per-CPU lock.
+*/
+static inline size_t memorypa_own_get_cpu() {
+  #ifdef _MSC_VER
+  return GetCurrentProcessorNumber();
+  #else
+  #ifdef MEMORYPA_RSEQ
+  if(__rseq_size) {
+    struct rseq *area = (struct rseq *)((unsigned char *)__builtin_thread_pointer() + __rseq_offset);
+    int cpu = (int)__atomic_load_n(&area->cpu_id, __ATOMIC_RELAXED);
+    if(cpu >= 0) {
+      return (size_t)cpu;
+    }
+  }
+  #endif
+  int cpu = sched_getcpu();
+  return cpu >= 0 ? (size_t)cpu : 0;
+  #endif
+}
+
 static inline unsigned char memorypa_lock_test_set(unsigned char *operand) {
   #ifdef _MSC_VER
   return _InterlockedOr8((char *)operand, 1);
@@ -89,6 +201,51 @@ static inline unsigned char memorypa_lock_load(unsigned char *operand) {
   #endif
 }
 
+static inline unsigned long long memorypa_free_block_head_load(unsigned long long *operand) {
+  #ifdef _MSC_VER
+  return (unsigned long long)_InterlockedCompareExchange64((volatile __int64 *)operand, 0, 0);
+  #else
+  return __atomic_load_n(operand, __ATOMIC_ACQUIRE);
+  #endif
+}
+
+static inline void memorypa_free_block_head_store(unsigned long long *operand, unsigned long long value) {
+  #ifdef _MSC_VER
+  InterlockedExchange64((volatile LONG64 *)operand, (LONG64)value);
+  #else
+  __atomic_store_n(operand, value, __ATOMIC_RELEASE);
+  #endif
+}
+
+static inline unsigned char memorypa_free_block_head_compare_exchange(unsigned long long *operand, unsigned long long *expected, unsigned long long desired) {
+  #ifdef _MSC_VER
+  unsigned long long previous = (unsigned long long)_InterlockedCompareExchange64((volatile __int64 *)operand, (__int64)desired, (__int64)(*expected));
+  if(previous == *expected) {
+    return 1;
+  }
+  *expected = previous;
+  return 0;
+  #else
+  return __atomic_compare_exchange_n(operand, expected, desired, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  #endif
+}
+
+static inline size_t memorypa_free_block_link_load(unsigned char *free_block) {
+  #ifdef _MSC_VER
+  return *((volatile size_t *)free_block);
+  #else
+  return __atomic_load_n((size_t *)free_block, __ATOMIC_RELAXED);
+  #endif
+}
+
+static inline void memorypa_free_block_link_store(unsigned char *free_block, size_t link) {
+  #ifdef _MSC_VER
+  *((volatile size_t *)free_block) = link;
+  #else
+  __atomic_store_n((size_t *)free_block, link, __ATOMIC_RELAXED);
+  #endif
+}
+
 static inline void memorypa_lock(unsigned char *lock) {
   while(memorypa_lock_test_set(lock));
 }
@@ -97,6 +254,199 @@ static inline void memorypa_unlock(unsigned char *lock) {
   memorypa_unlock_clear(lock);
 }
 
+static inline void memorypa_pause() {
+  #ifdef _MSC_VER
+  YieldProcessor();
+  #elif defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+  #elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+  #endif
+}
+
+static inline unsigned int memorypa_queue_lock_fetch_add(unsigned int *operand, unsigned int value) {
+  #ifdef _MSC_VER
+  return (unsigned int)_InterlockedExchangeAdd((volatile long *)operand, (long)value);
+  #else
+  return __atomic_fetch_add(operand, value, __ATOMIC_SEQ_CST);
+  #endif
+}
+
+static inline unsigned int memorypa_queue_lock_load(unsigned int *operand) {
+  #ifdef _MSC_VER
+  return (unsigned int)_InterlockedOr((volatile long *)operand, 0);
+  #else
+  return __atomic_load_n(operand, __ATOMIC_SEQ_CST);
+  #endif
+}
+
+static inline size_t memorypa_event_fetch_add(size_t *operand, size_t value) {
+  #ifdef _MSC_VER
+  #ifdef _WIN64
+  return (size_t)_InterlockedExchangeAdd64((volatile __int64 *)operand, (__int64)value);
+  #else
+  return (size_t)_InterlockedExchangeAdd((volatile long *)operand, (long)value);
+  #endif
+  #else
+  return __atomic_fetch_add(operand, value, __ATOMIC_RELAXED);
+  #endif
+}
+
+static inline size_t memorypa_event_load(size_t *operand) {
+  #ifdef _MSC_VER
+  return *((volatile size_t *)operand);
+  #else
+  return __atomic_load_n(operand, __ATOMIC_ACQUIRE);
+  #endif
+}
+
+static inline size_t memorypa_profile_fetch_add(size_t *operand, size_t value) {
+  #ifdef _MSC_VER
+  #ifdef _WIN64
+  return (size_t)_InterlockedExchangeAdd64((volatile __int64 *)operand, (__int64)value);
+  #else
+  return (size_t)_InterlockedExchangeAdd((volatile long *)operand, (long)value);
+  #endif
+  #else
+  return __atomic_fetch_add(operand, value, __ATOMIC_RELAXED);
+  #endif
+}
+
+static inline size_t memorypa_profile_load(size_t *operand) {
+  #ifdef _MSC_VER
+  return *((volatile size_t *)operand);
+  #else
+  return __atomic_load_n(operand, __ATOMIC_RELAXED);
+  #endif
+}
+
+static inline unsigned char memorypa_profile_compare_exchange(size_t *operand, size_t *expected, size_t desired) {
+  #ifdef _MSC_VER
+  #ifdef _WIN64
+  size_t previous = (size_t)_InterlockedCompareExchange64((volatile __int64 *)operand, (__int64)desired, (__int64)(*expected));
+  #else
+  size_t previous = (size_t)_InterlockedCompareExchange((volatile long *)operand, (long)desired, (long)(*expected));
+  #endif
+  if(previous == *expected) {
+    return 1;
+  }
+  *expected = previous;
+  return 0;
+  #else
+  return __atomic_compare_exchange_n(operand, expected, desired, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  #endif
+}
+
+static inline void memorypa_event_store(size_t *operand, size_t value) {
+  #ifdef _MSC_VER
+  *((volatile size_t *)operand) = value;
+  #else
+  __atomic_store_n(operand, value, __ATOMIC_RELEASE);
+  #endif
+}
+
+static inline void memorypa_event_fence() {
+  #ifdef _MSC_VER
+  MemoryBarrier();
+  #else
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  #endif
+}
+
+/*
+  Sleeps until "*operand" might no longer be "value". Only Linux can
+  actually park the thread on the address (a futex). Everywhere else the
+  thread merely gives up the rest of its time slice. Sleepers are tagged
+  by their ticket so that waking a given ticket doesn't wake everyone
+  else too.
+*/
+static inline void memorypa_queue_lock_wait(unsigned int *operand, unsigned int value, unsigned int ticket) {
+  #ifdef _MSC_VER
+  (void)operand;
+  (void)value;
+  (void)ticket;
+  SwitchToThread();
+  #elif defined(__linux__)
+  syscall(SYS_futex, operand, FUTEX_WAIT_BITSET_PRIVATE, value, NULL, NULL, 1u << (ticket & 31));
+  #else
+  (void)operand;
+  (void)value;
+  (void)ticket;
+  sched_yield();
+  #endif
+}
+
+static inline void memorypa_queue_lock_wake(unsigned int *operand, unsigned int ticket) {
+  #if !defined(_MSC_VER) && defined(__linux__)
+  syscall(SYS_futex, operand, FUTEX_WAKE_BITSET_PRIVATE, INT_MAX, NULL, NULL, 1u << (ticket & 31));
+  #else
+  (void)operand;
+  (void)ticket;
+  #endif
+}
+
+/*
+  A ticket lock, so threads get the lock in the order they asked for
+  it:
+
+  unsigned int next_ticket
+  unsigned int now_serving
+  unsigned int sleepers
+
+  The thread next in line spins (politely) for a bounded number of
+  rounds. Threads further back, or done spinning, register as sleepers
+  and park on "now_serving". An unlock with sleepers only wakes the ones
+  holding the next ticket. Incrementing "sleepers" before parking and
+  loading it after bumping "now_serving" (both sequentially consistent)
+  guarantees that either the unlocking thread sees the sleeper or the
+  sleeper sees the new "now_serving" and doesn't park.
+*/
+static inline void memorypa_queue_lock(unsigned int *lock) {
+  unsigned int ticket = memorypa_queue_lock_fetch_add(lock, 1);
+  unsigned int now_serving;
+  unsigned int spins = 0;
+  while((now_serving = memorypa_queue_lock_load(lock + 1)) != ticket) {
+    if(ticket - now_serving == 1 && spins < MEMORYPA_QUEUE_LOCK_SPINS) {
+      memorypa_pause();
+      ++spins;
+    }
+    else {
+      memorypa_queue_lock_fetch_add(lock + 2, 1);
+      memorypa_queue_lock_wait(lock + 1, now_serving, ticket);
+      memorypa_queue_lock_fetch_add(lock + 2, (unsigned int)-1);
+    }
+  }
+}
+
+static inline void memorypa_queue_unlock(unsigned int *lock) {
+  unsigned int now_serving = memorypa_queue_lock_fetch_add(lock + 1, 1) + 1;
+  if(memorypa_queue_lock_load(lock + 2)) {
+    memorypa_queue_lock_wake(lock + 1, now_serving);
+  }
+}
+
+/*
+  Pool locks hold enough room for a queue lock. The spin lock
+  only uses the first byte.
+*/
+static inline void memorypa_selected_lock(unsigned int *lock, unsigned char synchronization) {
+  if(synchronization == MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK) {
+    memorypa_queue_lock(lock);
+  }
+  else {
+    memorypa_lock((unsigned char *)lock);
+  }
+}
+
+static inline void memorypa_selected_unlock(unsigned int *lock, unsigned char synchronization) {
+  if(synchronization == MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK) {
+    memorypa_queue_unlock(lock);
+  }
+  else {
+    memorypa_unlock((unsigned char *)lock);
+  }
+}
+
 /*
   Returns the position of the most significant bit of the given
   number. The minimum is 1 and the maximum is some small power of 2,
@@ -109,8 +459,23 @@ static inline void memorypa_unlock(unsigned char *lock) {
   particular bisection algorithm requires a proper power of 2 to split
   the machine word when searching for set bits. Anything else and the
   bisection will fail with truncation errors.
+
+  MSVC and GCC-compatible compilers skip the bisection entirely and count
+  leading zeros with a single instruction (BSR or LZCNT). Zero is
+  treated like one to keep the minimum at 1.
 */
 static inline size_t memorypa_own_msb(size_t value) {
+  #if defined(_MSC_VER) && defined(_WIN64)
+  unsigned long index;
+  _BitScanReverse64(&index, (unsigned __int64)(value | 1));
+  return (size_t)index + 1;
+  #elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse(&index, (unsigned long)(value | 1));
+  return (size_t)index + 1;
+  #elif defined(__GNUC__)
+  return (sizeof(unsigned long long) * CHAR_BIT) - (size_t)__builtin_clzll((unsigned long long)(value | 1));
+  #else
   size_t output = 1;
   size_t current_split = memorypa_size_t_half_bit_size_next_power;
   do {
@@ -122,643 +487,3190 @@ static inline size_t memorypa_own_msb(size_t value) {
   }
   while(current_split);
   return output;
+  #endif
 }
 
-static inline size_t memorypa_adjust_msb(size_t value, size_t msb, size_t padding) {
-  if(padding) {
-    if(value <= padding) {
-      return msb - 1;
-    }
-    size_t adjusted_msb = msb - 1;
-    size_t bit_check = value - padding;
-    bit_check >>= adjusted_msb;
-    return adjusted_msb + bit_check;
+/*
+  Each class counts its profiled allocations on a cache line of its own:
+
+  size_t count
+  size_t max
+
+  followed by a shard for every CPU, a cache-line-rounded row of one
+  "size_t" per class. Nothing locks them. Allocations and deallocations
+  move the shard of the current CPU, which only spills into the shared
+  count once it reaches "MEMORYPA_PROFILE_SPILL" either way, so most
+  updates never leave the core. A deallocation may land on another CPU
+  than its allocation, so shards wrap below zero and only their sum
+  means anything. The shards are merged into the count whenever it's
+  read.
+
+  Each allocation raises the max to the shared count plus its own shard.
+  The other shards are missing from that sum, so the max is off from the
+  true high-water mark by less than "MEMORYPA_PROFILE_SPILL" allocations
+  per CPU, in either direction. It's exact for a single thread, and a
+  read never reports it below the merged count.
+*/
+static inline size_t * memorypa_profile_get_shard(size_t index) {
+  size_t cpu = memorypa_own_get_cpu();
+  if(cpu >= memorypa_cpu_count) {
+    cpu %= memorypa_cpu_count;
   }
-  return msb;
+  return (size_t *)(memorypa_profile_list + memorypa_profile_shards_offset + (cpu * memorypa_profile_shard_size)) + index;
 }
 
 static inline void memorypa_profile_increment(size_t index) {
-  unsigned char *block = memorypa_profile_list + (index * memorypa_2st);
-  size_t count = ++(*((size_t *)block));
-  block += memorypa_size_t_size;
-  if(count > *((size_t *)block)) {
-    *((size_t *)block) = count;
+  size_t *block = (size_t *)(memorypa_profile_list + (index * memorypa_1cl));
+  size_t *shard = memorypa_profile_get_shard(index);
+  size_t count = memorypa_profile_fetch_add(shard, 1) + 1;
+  size_t max;
+  // Exactly one thread sees the shard reach the spill:
+  if(count == MEMORYPA_PROFILE_SPILL) {
+    memorypa_profile_fetch_add(shard, (size_t)0 - MEMORYPA_PROFILE_SPILL);
+    count = memorypa_profile_fetch_add(block, MEMORYPA_PROFILE_SPILL) + MEMORYPA_PROFILE_SPILL;
   }
+  else {
+    count += memorypa_profile_load(block);
+  }
+  // Below zero, from deallocations this shard hasn't seen the allocations of:
+  if(count > (((size_t)-1) >> 1)) {
+    return;
+  }
+  max = memorypa_profile_load(block + 1);
+  while(count > max && !memorypa_profile_compare_exchange(block + 1, &max, count));
 }
 
 static inline void memorypa_profile_decrement(size_t index) {
-  --(*((size_t *)(memorypa_profile_list + (index * memorypa_2st))));
+  size_t *shard = memorypa_profile_get_shard(index);
+  if(memorypa_profile_fetch_add(shard, (size_t)-1) - 1 == (size_t)0 - MEMORYPA_PROFILE_SPILL) {
+    memorypa_profile_fetch_add(shard, MEMORYPA_PROFILE_SPILL);
+    memorypa_profile_fetch_add((size_t *)(memorypa_profile_list + (index * memorypa_1cl)), (size_t)0 - MEMORYPA_PROFILE_SPILL);
+  }
 }
 
 static inline size_t memorypa_profile_get_count(size_t index) {
-  return *((size_t *)(memorypa_profile_list + (index * memorypa_2st)));
+  size_t output = memorypa_profile_load((size_t *)(memorypa_profile_list + (index * memorypa_1cl)));
+  size_t cpu = 0;
+  do {
+    output += memorypa_profile_load((size_t *)(memorypa_profile_list + memorypa_profile_shards_offset + (cpu * memorypa_profile_shard_size)) + index);
+  }
+  while(++cpu < memorypa_cpu_count);
+  // A deallocation may have been counted before its allocation:
+  return output > (((size_t)-1) >> 1) ? 0 : output;
 }
 
 static inline size_t memorypa_profile_get_max(size_t index) {
-  return *((size_t *)(memorypa_profile_list + (index * memorypa_2st) + memorypa_size_t_size));
+  size_t output = memorypa_profile_load((size_t *)(memorypa_profile_list + (index * memorypa_1cl)) + 1);
+  size_t count = memorypa_profile_get_count(index);
+  return count > output ? count : output;
+}
+
+/*
+  With "profile_histogram", every profiled allocation is also counted by
+  its exact size. Power n holds the sizes from 2^(n - 1) to 2^n - 1, split
+  into "MEMORYPA_PROFILE_BUCKETS" buckets of equal width (a width of 1 for
+  the small powers). On top of that, the first "MEMORYPA_PROFILE_SIZES"
+  distinct sizes of each power claim a slot of their own:
+
+  size_t size + 1 (0 while the slot is free)
+  size_t count
+
+  Unlike the classes, these count every allocation ever made, since they
+  describe what is asked for rather than what is held.
+*/
+static inline size_t memorypa_profile_get_bucket_shift(size_t power) {
+  return power > MEMORYPA_PROFILE_BUCKETS_SHIFT + 1 ? power - MEMORYPA_PROFILE_BUCKETS_SHIFT - 1 : 0;
+}
+
+static inline void memorypa_profile_record_size(size_t size) {
+  size_t power = memorypa_own_msb(size);
+  size_t offset = size & ((memorypa_one << (power - 1)) - 1);
+  memorypa_profile_fetch_add(memorypa_profile_buckets + (power << MEMORYPA_PROFILE_BUCKETS_SHIFT) + (offset >> memorypa_profile_get_bucket_shift(power)), 1);
+  size_t *slot = memorypa_profile_sizes + (power * (MEMORYPA_PROFILE_SIZES << 1));
+  size_t *end = slot + (MEMORYPA_PROFILE_SIZES << 1);
+  size_t claimed;
+  do {
+    claimed = memorypa_profile_load(slot);
+    // A weak exchange may fail spuriously, so retry while the slot stays free:
+    while(!claimed && !memorypa_profile_compare_exchange(slot, &claimed, size + 1));
+    if(!claimed || claimed == size + 1) {
+      memorypa_profile_fetch_add(slot + 1, 1);
+      return;
+    }
+  }
+  while((slot += 2) != end);
+}
+
+/*
+  With "profile_sample_rate", the profiler also samples a call stack about
+  once every "profile_sample_rate" bytes allocated. Each thread counts
+  down the bytes to its next sample, and the distance between samples is
+  drawn from an exponential distribution, so that every byte is equally
+  likely to be sampled no matter how the program sizes its allocations.
+  Allocations that aren't sampled only pay for the subtraction.
+
+  The distance is "profile_sample_rate" times -ln(u) for a uniform "u",
+  computed in 16-bit fixed point from a 32-bit "u": -log2(u) is found bit
+  by bit through repeated squaring, then multiplied by ln(2).
+*/
+static inline size_t memorypa_profile_sample_get_distance() {
+  unsigned long long state = memorypa_profile_sample_state;
+  if(!state) {
+    // Each thread gets its own stream:
+    state = ((unsigned long long)(size_t)&memorypa_profile_sample_state) ^ ((unsigned long long)memorypa_profile_fetch_add(&memorypa_profile_sample_threads, 1) * 0x9e3779b97f4a7c15ULL);
+    state = state ? state : 1;
+  }
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  memorypa_profile_sample_state = state;
+  // "u" is in (0, 1], i.e. "x" / 2^32 with "x" in [1, 2^32]:
+  unsigned long long x = (state >> 32) + 1;
+  unsigned long long whole = 0;
+  while((x >> whole) > 1) {
+    ++whole;
+  }
+  // Normalize "x" to [1, 2) in 31-bit fixed point for the fraction:
+  unsigned long long y = whole > 31 ? x >> (whole - 31) : x << (31 - whole);
+  unsigned long long log2_x = whole << 16;
+  unsigned long long bit = 1ULL << 15;
+  do {
+    y = (y * y) >> 31;
+    if(y >= (2ULL << 31)) {
+      y >>= 1;
+      log2_x |= bit;
+    }
+  }
+  while(bit >>= 1);
+  // 45426 is ln(2) in 16-bit fixed point:
+  unsigned long long natural = (((32ULL << 16) - log2_x) * 45426) >> 16;
+  unsigned long long rate = memorypa_profile_sample_rate;
+  unsigned long long distance = ((rate >> 16) * natural) + (((rate & 0xffff) * natural) >> 16);
+  return distance ? (size_t)distance : 1;
+}
+
+static inline unsigned char memorypa_profile_sample(size_t size) {
+  size_t countdown = memorypa_profile_sample_countdown;
+  if(!countdown) {
+    countdown = memorypa_profile_sample_get_distance();
+  }
+  if(size < countdown) {
+    memorypa_profile_sample_countdown = countdown - size;
+    return 0;
+  }
+  memorypa_profile_sample_countdown = memorypa_profile_sample_get_distance();
+  return 1;
+}
+
+static inline size_t memorypa_profile_capture(void **frames) {
+  #ifdef _MSC_VER
+  return (size_t)CaptureStackBackTrace(0, MEMORYPA_PROFILE_DEPTH, frames, NULL);
+  #elif defined(MEMORYPA_BACKTRACE)
+  int depth = backtrace(frames, MEMORYPA_PROFILE_DEPTH);
+  return depth > 0 ? (size_t)depth : 0;
+  #else
+  // Without an unwinder, only the caller of the profiled function is known:
+  frames[0] = __builtin_return_address(0);
+  return 1;
+  #endif
+}
+
+/*
+  Samples are grouped by call stack and power in a fixed table of
+  "MEMORYPA_PROFILE_SITES" sites, allocated with the pools, so sampling
+  never allocates. Each site is:
+
+  size_t key (0 while free, 1 while being claimed)
+  size_t power
+  size_t depth
+  size_t count (live sampled allocations)
+  size_t bytes (live sampled bytes)
+  size_t peak (the most live sampled bytes so far)
+  size_t total_count
+  size_t total_bytes
+  void *frames[MEMORYPA_PROFILE_DEPTH]
+
+  Sites are found by hashing their stack and power, and claimed with a
+  compare-and-swap. A claimed site is published by storing its key once
+  its stack is written, so that others only ever compare whole stacks.
+  Once the table is full, samples from new stacks are dropped.
+*/
+static inline size_t * memorypa_profile_site_at(size_t index) {
+  return (size_t *)(memorypa_profile_site_list + (index * memorypa_profile_site_size));
+}
+
+static inline size_t * memorypa_profile_site_find(void **frames, size_t depth, size_t power) {
+  unsigned long long hash = 0xcbf29ce484222325ULL ^ power;
+  size_t i = 0;
+  while(i < depth) {
+    hash = (hash ^ (unsigned long long)(size_t)frames[i++]) * 0x100000001b3ULL;
+  }
+  size_t key = (size_t)(hash ^ (hash >> 32));
+  key = key < 2 ? key + 2 : key;
+  size_t *site;
+  size_t found;
+  size_t probe = 0;
+  do {
+    site = memorypa_profile_site_at((key + probe) & (MEMORYPA_PROFILE_SITES - 1));
+    found = memorypa_event_load(site);
+    while(!found && !memorypa_profile_compare_exchange(site, &found, 1));
+    if(!found) {
+      site[1] = power;
+      site[2] = depth;
+      memcpy(site + 8, frames, depth * memorypa_u_char_p_size);
+      memorypa_event_store(site, key);
+      return site;
+    }
+    while(found == 1) {
+      memorypa_pause();
+      found = memorypa_event_load(site);
+    }
+    if(found == key && site[1] == power && site[2] == depth && !memcmp(site + 8, frames, depth * memorypa_u_char_p_size)) {
+      return site;
+    }
+  }
+  while(++probe < MEMORYPA_PROFILE_SITES);
+  return NULL;
+}
+
+static inline size_t memorypa_profile_site_record(size_t size, size_t power) {
+  void *frames[MEMORYPA_PROFILE_DEPTH];
+  size_t *site = memorypa_profile_site_find(frames, memorypa_profile_capture(frames), power);
+  if(site == NULL) {
+    return 0;
+  }
+  memorypa_profile_fetch_add(site + 3, 1);
+  size_t bytes = memorypa_profile_fetch_add(site + 4, size) + size;
+  size_t peak = memorypa_profile_load(site + 5);
+  while(bytes > peak && !memorypa_profile_compare_exchange(site + 5, &peak, bytes));
+  memorypa_profile_fetch_add(site + 6, 1);
+  memorypa_profile_fetch_add(site + 7, size);
+  return (size_t)((((unsigned char *)site) - memorypa_profile_site_list) / memorypa_profile_site_size) + 1;
+}
+
+static inline void memorypa_profile_site_release(size_t index, size_t size) {
+  size_t *site = memorypa_profile_site_at(index - 1);
+  memorypa_profile_fetch_add(site + 3, (size_t)-1);
+  memorypa_profile_fetch_add(site + 4, (size_t)0 - size);
 }
 
 /*
-  unsigned char lock
+  Every pool starts on a cache line. The first cache line holds all the
+  fields that change while allocating, and the second holds the fields
+  that never change after initialization, so threads reading the latter
+  don't keep stealing the line from threads taking the lock. All fields
+  are naturally aligned:
+
+  unsigned long long free_block_head
+  size_t free_blocks
+  unsigned char *free_block_top
+  unsigned int lock[3]
+  unsigned char synchronization
+  unsigned char segment_count
+  (padding up to the next unsigned long long)
+  unsigned long long carved_blocks
+  unsigned char *segment_list
+  size_t dirty_blocks
+  (padding up to the next cache line)
   size_t block_size
   size_t block_padding
   size_t block_amount
-  size_t free_blocks
+  size_t cache_amount
+  size_t cache_position
+  size_t class_index
   unsigned char *block_list
-  unsigned char *free_block_list[block_amount]
+  unsigned char free_list
+  unsigned char prefetch
+  unsigned char per_cpu
+  unsigned char segments
+  unsigned char trim
+  (padding up to the next cache line)
+  unsigned char *free_block_list[block_amount] (holds links instead in lock-free pools, absent in intrusive pools)
   {unsigned char *pool, unsigned char terminator[2], unsigned char data[block_size]} blocks[block_amount]
+  (padding up to the next cache line)
+
+  With "native_alignment", the block list starts on
+  "MEMORYPA_NATIVE_ALIGNMENT", padding goes between each block's pool
+  pointer and its terminator, and more padding follows each block's data,
+  so that every "data" lands on "MEMORYPA_NATIVE_ALIGNMENT".
+
+  Intrusive pools keep no "free_block_list". Instead, "free_block_top"
+  points to the last freed block, and the start of each free block's data
+  points to the block freed before it.
+
+  Blocks are carved lazily: only the first "carved_blocks" blocks (and
+  their free block list slots) have ever been written. Allocation takes
+  from the free list first and carves the next blocks once it runs dry,
+  so initialization never touches the blocks themselves and the
+  operating system only backs the pages that actually get used.
+
+  Once every block is carved and the free list runs dry, growable pools
+  (intrusive ones with "segments") get another segment of blocks from the
+  given "malloc", up to "segments" of them. Each segment holds twice as
+  many blocks as the one before it, starting with "block_amount":
+
+  unsigned char *next
+  size_t amount
+  (padding up to the block alignment)
+  {unsigned char *pool, unsigned char terminator[2], unsigned char data[block_size]} blocks[amount]
 */
-static inline size_t memorypa_pool_get_block_list_offset(size_t block_amount) {
-  return memorypa_1uc_4st_1ucp + (memorypa_u_char_p_size * block_amount);
+static inline size_t memorypa_round_up_to_cache_line(size_t size) {
+  return (size + MEMORYPA_CACHE_LINE_SIZE - 1) & ~((size_t)MEMORYPA_CACHE_LINE_SIZE - 1);
 }
 
-static inline size_t memorypa_pool_get_total_size(size_t block_size, size_t block_amount) {
-  return memorypa_pool_get_block_list_offset(block_amount) + ((memorypa_1ucp_2uc + block_size) * block_amount);
+static inline size_t memorypa_round_up_to_block_alignment(size_t size) {
+  return (size + memorypa_block_alignment - 1) & ~(memorypa_block_alignment - 1);
 }
 
-static inline void memorypa_pool_set_lock(unsigned char *pool) {
-  memorypa_unlock_clear(pool);
+static inline size_t memorypa_pool_get_block_list_offset(size_t block_amount, unsigned char free_list) {
+  if(free_list == MEMORYPA_FREE_LIST_INTRUSIVE) {
+    return memorypa_2cl;
+  }
+  return memorypa_round_up_to_block_alignment(memorypa_2cl + (memorypa_u_char_p_size * block_amount));
 }
 
-static inline unsigned char memorypa_pool_lock_load(unsigned char *pool) {
-  return memorypa_lock_load(pool);
+static inline size_t memorypa_pool_get_block_stride(size_t block_size) {
+  return memorypa_round_up_to_block_alignment(memorypa_block_header_size + block_size);
 }
 
-static inline void memorypa_pool_lock(unsigned char *pool) {
-  memorypa_lock(pool);
+// Trimming must leave the block header and the intrusive link alone:
+static inline size_t memorypa_pool_get_trim_offset(unsigned char free_list) {
+  return memorypa_block_header_size + (free_list == MEMORYPA_FREE_LIST_INTRUSIVE ? memorypa_u_char_p_size : 0);
 }
 
-static inline void memorypa_pool_unlock(unsigned char *pool) {
-  memorypa_unlock(pool);
+static inline size_t memorypa_pool_get_total_size(size_t block_size, size_t block_amount, unsigned char free_list) {
+  return memorypa_round_up_to_cache_line(memorypa_pool_get_block_list_offset(block_amount, free_list) + (memorypa_pool_get_block_stride(block_size) * block_amount));
 }
 
-static inline void memorypa_pool_set_block_size(unsigned char *pool, size_t size) {
-  *((size_t *)(pool + memorypa_u_char_size)) = size;
+static inline unsigned long long * memorypa_pool_get_free_block_head(unsigned char *pool) {
+  return (unsigned long long *)pool;
 }
 
-static inline size_t memorypa_pool_get_block_size(unsigned char *pool) {
-  return *((size_t *)(pool + memorypa_u_char_size));
+static inline void memorypa_pool_set_synchronization(unsigned char *pool, unsigned char synchronization) {
+  *(pool + memorypa_1ull_1st_1ucp_3ui) = synchronization;
 }
 
-static inline void memorypa_pool_set_block_padding(unsigned char *pool, size_t padding) {
-  *((size_t *)(pool + memorypa_1uc_1st)) = padding;
+static inline unsigned char memorypa_pool_get_synchronization(unsigned char *pool) {
+  return *(pool + memorypa_1ull_1st_1ucp_3ui);
 }
 
-static inline size_t memorypa_pool_get_block_padding(unsigned char *pool) {
-  return *((size_t *)(pool + memorypa_1uc_1st));
+static inline unsigned long long * memorypa_pool_get_carved_blocks(unsigned char *pool) {
+  return (unsigned long long *)(pool + memorypa_1ull_1st_1ucp_4ui);
 }
 
-static inline void memorypa_pool_set_block_amount(unsigned char *pool, size_t amount) {
-  *((size_t *)(pool + memorypa_1uc_2st)) = amount;
+static inline void memorypa_pool_set_segment_list(unsigned char *pool, unsigned char *segment) {
+  *((unsigned char **)(pool + memorypa_1ull_1st_1ucp_4ui_1ull)) = segment;
 }
 
-static inline size_t memorypa_pool_get_block_amount(unsigned char *pool) {
-  return *((size_t *)(pool + memorypa_1uc_2st));
+static inline unsigned char * memorypa_pool_get_segment_list(unsigned char *pool) {
+  return *((unsigned char **)(pool + memorypa_1ull_1st_1ucp_4ui_1ull));
 }
 
-static inline void memorypa_pool_set_free_blocks(unsigned char *pool, size_t free_blocks) {
-  *((size_t *)(pool + memorypa_1uc_3st)) = free_blocks;
+static inline void memorypa_pool_set_segment_count(unsigned char *pool, size_t segment_count) {
+  *(pool + memorypa_1ull_1st_1ucp_3ui_1uc) = (unsigned char)segment_count;
 }
 
-static inline size_t memorypa_pool_get_free_blocks(unsigned char *pool) {
-  return *((size_t *)(pool + memorypa_1uc_3st));
+static inline size_t memorypa_pool_get_segment_count(unsigned char *pool) {
+  return *(pool + memorypa_1ull_1st_1ucp_3ui_1uc);
 }
 
-static inline void memorypa_pool_set_block_list(unsigned char *pool, size_t block_amount) {
-  *((unsigned char **)(pool + memorypa_1uc_4st)) = pool + memorypa_pool_get_block_list_offset(block_amount);
+static inline void memorypa_pool_set_dirty_blocks(unsigned char *pool, size_t dirty_blocks) {
+  *((size_t *)(pool + memorypa_1ull_1st_1ucp_4ui_1ull_1ucp)) = dirty_blocks;
 }
 
-static inline unsigned char * memorypa_pool_get_block_list(unsigned char *pool) {
-  return *((unsigned char **)(pool + memorypa_1uc_4st));
+static inline size_t memorypa_pool_get_dirty_blocks(unsigned char *pool) {
+  return *((size_t *)(pool + memorypa_1ull_1st_1ucp_4ui_1ull_1ucp));
 }
 
-static inline unsigned char * memorypa_pool_get_free_block_list(unsigned char *pool) {
-  return pool + memorypa_1uc_4st_1ucp;
+// Blocks left the top of the free list, so fewer of them may be dirty:
+static inline void memorypa_pool_clean_blocks(unsigned char *pool, size_t amount) {
+  size_t dirty_blocks = memorypa_pool_get_dirty_blocks(pool);
+  memorypa_pool_set_dirty_blocks(pool, dirty_blocks > amount ? dirty_blocks - amount : 0);
 }
 
-static inline unsigned char * memorypa_pool_free_block_list_at(unsigned char *free_block_list, size_t index) {
-  return free_block_list + (memorypa_u_char_p_size * index);
+static inline void memorypa_pool_set_free_block_top(unsigned char *pool, unsigned char *block) {
+  *((unsigned char **)(pool + memorypa_1ull_1st)) = block;
 }
 
-static inline void memorypa_pool_free_block_set_block(unsigned char *free_block, unsigned char *block) {
-  *((unsigned char **)free_block) = block;
+static inline unsigned char * memorypa_pool_get_free_block_top(unsigned char *pool) {
+  return *((unsigned char **)(pool + memorypa_1ull_1st));
 }
 
-static inline unsigned char * memorypa_pool_free_block_get_block(unsigned char *free_block) {
-  return *((unsigned char **)free_block);
+static inline void memorypa_pool_set_lock(unsigned char *pool) {
+  memset(pool + memorypa_1ull_1st_1ucp, 0, 3 * memorypa_u_int_size);
 }
 
-static inline unsigned char * memorypa_pool_block_list_at(unsigned char *block_list, size_t block_size, size_t index) {
-  return block_list + ((memorypa_1ucp_2uc + block_size) * index);
+static inline unsigned char memorypa_pool_lock_load(unsigned char *pool) {
+  return memorypa_lock_load(pool + memorypa_1ull_1st_1ucp);
 }
 
-static inline void memorypa_pool_block_set_pool(unsigned char *block, unsigned char *pool) {
-  *((unsigned char **)block) = pool;
+static inline void memorypa_pool_lock(unsigned char *pool) {
+  memorypa_selected_lock((unsigned int *)(pool + memorypa_1ull_1st_1ucp), memorypa_pool_get_synchronization(pool));
 }
 
-static inline unsigned char * memorypa_pool_block_get_pool(unsigned char *block) {
-  return *((unsigned char **)block);
+static inline void memorypa_pool_unlock(unsigned char *pool) {
+  memorypa_selected_unlock((unsigned int *)(pool + memorypa_1ull_1st_1ucp), memorypa_pool_get_synchronization(pool));
 }
 
-static inline void memorypa_pool_block_set_terminator(unsigned char *block) {
-  block += memorypa_u_char_p_size;
-  *block = 0;
-  block += memorypa_u_char_size;
-  *block = 0;
+static inline void memorypa_pool_set_block_size(unsigned char *pool, size_t size) {
+  *((size_t *)(pool + memorypa_1cl)) = size;
 }
 
-static inline unsigned short memorypa_pool_block_get_terminator(unsigned char *block) {
-  block += memorypa_u_char_p_size;
-  unsigned short output = *block;
-  output <<= memorypa_u_char_bit_size;
-  block += memorypa_u_char_size;
-  output += *block;
-  return output;
+static inline size_t memorypa_pool_get_block_size(unsigned char *pool) {
+  return *((size_t *)(pool + memorypa_1cl));
 }
 
-static inline unsigned char * memorypa_pool_block_get_data(unsigned char *block) {
-  return block + memorypa_1ucp_2uc;
+static inline void memorypa_pool_set_block_padding(unsigned char *pool, size_t padding) {
+  *((size_t *)(pool + memorypa_1cl_1st)) = padding;
+}
+
+static inline size_t memorypa_pool_get_block_padding(unsigned char *pool) {
+  return *((size_t *)(pool + memorypa_1cl_1st));
+}
+
+static inline void memorypa_pool_set_block_amount(unsigned char *pool, size_t amount) {
+  *((size_t *)(pool + memorypa_1cl_2st)) = amount;
+}
+
+static inline size_t memorypa_pool_get_block_amount(unsigned char *pool) {
+  return *((size_t *)(pool + memorypa_1cl_2st));
+}
+
+static inline void memorypa_pool_set_free_blocks(unsigned char *pool, size_t free_blocks) {
+  *((size_t *)(pool + memorypa_1ull)) = free_blocks;
+}
+
+static inline size_t memorypa_pool_get_free_blocks(unsigned char *pool) {
+  return *((size_t *)(pool + memorypa_1ull));
+}
+
+static inline void memorypa_pool_set_cache_amount(unsigned char *pool, size_t cache_amount) {
+  *((size_t *)(pool + memorypa_1cl_3st)) = cache_amount;
+}
+
+static inline size_t memorypa_pool_get_cache_amount(unsigned char *pool) {
+  return *((size_t *)(pool + memorypa_1cl_3st));
+}
+
+static inline void memorypa_pool_set_cache_position(unsigned char *pool, size_t cache_position) {
+  *((size_t *)(pool + memorypa_1cl_4st)) = cache_position;
+}
+
+static inline size_t memorypa_pool_get_cache_position(unsigned char *pool) {
+  return *((size_t *)(pool + memorypa_1cl_4st));
+}
+
+static inline void memorypa_pool_set_class_index(unsigned char *pool, size_t class_index) {
+  *((size_t *)(pool + memorypa_1cl_5st)) = class_index;
+}
+
+static inline size_t memorypa_pool_get_class_index(unsigned char *pool) {
+  return *((size_t *)(pool + memorypa_1cl_5st));
+}
+
+static inline void memorypa_pool_set_free_list(unsigned char *pool, unsigned char free_list) {
+  *(pool + memorypa_1cl_6st_1ucp) = free_list;
+}
+
+static inline unsigned char memorypa_pool_get_free_list(unsigned char *pool) {
+  return *(pool + memorypa_1cl_6st_1ucp);
+}
+
+static inline void memorypa_pool_set_prefetch(unsigned char *pool, unsigned char prefetch) {
+  *(pool + memorypa_1cl_6st_1ucp_1uc) = prefetch;
+}
+
+static inline unsigned char memorypa_pool_get_prefetch(unsigned char *pool) {
+  return *(pool + memorypa_1cl_6st_1ucp_1uc);
+}
+
+static inline void memorypa_pool_set_per_cpu(unsigned char *pool, unsigned char per_cpu) {
+  *(pool + memorypa_1cl_6st_1ucp_2uc) = per_cpu;
+}
+
+static inline unsigned char memorypa_pool_get_per_cpu(unsigned char *pool) {
+  return *(pool + memorypa_1cl_6st_1ucp_2uc);
+}
+
+static inline void memorypa_pool_set_segments(unsigned char *pool, unsigned char segments) {
+  *(pool + memorypa_1cl_6st_1ucp_3uc) = segments;
+}
+
+static inline unsigned char memorypa_pool_get_segments(unsigned char *pool) {
+  return *(pool + memorypa_1cl_6st_1ucp_3uc);
+}
+
+static inline void memorypa_pool_set_trim(unsigned char *pool, unsigned char trim) {
+  *(pool + memorypa_1cl_6st_1ucp_4uc) = trim;
+}
+
+static inline unsigned char memorypa_pool_get_trim(unsigned char *pool) {
+  return *(pool + memorypa_1cl_6st_1ucp_4uc);
+}
+
+static inline void memorypa_pool_set_block_list(unsigned char *pool, size_t block_amount, unsigned char free_list) {
+  *((unsigned char **)(pool + memorypa_1cl_6st)) = pool + memorypa_pool_get_block_list_offset(block_amount, free_list);
+}
+
+static inline unsigned char * memorypa_pool_get_block_list(unsigned char *pool) {
+  return *((unsigned char **)(pool + memorypa_1cl_6st));
+}
+
+static inline unsigned char * memorypa_pool_get_free_block_list(unsigned char *pool) {
+  return pool + memorypa_2cl;
+}
+
+static inline unsigned char * memorypa_pool_free_block_list_at(unsigned char *free_block_list, size_t index) {
+  return free_block_list + (memorypa_u_char_p_size * index);
+}
+
+static inline void memorypa_pool_free_block_set_block(unsigned char *free_block, unsigned char *block) {
+  *((unsigned char **)free_block) = block;
+}
+
+static inline unsigned char * memorypa_pool_free_block_get_block(unsigned char *free_block) {
+  return *((unsigned char **)free_block);
+}
+
+static inline unsigned char * memorypa_pool_block_list_at(unsigned char *block_list, size_t block_size, size_t index) {
+  return block_list + (memorypa_pool_get_block_stride(block_size) * index);
+}
+
+static inline size_t memorypa_segment_get_total_size(size_t block_size, size_t amount) {
+  // Leave room to align the blocks:
+  return memorypa_1st_1ucp + memorypa_block_alignment - 1 + (memorypa_pool_get_block_stride(block_size) * amount);
+}
+
+static inline void memorypa_segment_set_next(unsigned char *segment, unsigned char *next) {
+  *((unsigned char **)segment) = next;
+}
+
+static inline unsigned char * memorypa_segment_get_next(unsigned char *segment) {
+  return *((unsigned char **)segment);
+}
+
+static inline void memorypa_segment_set_amount(unsigned char *segment, size_t amount) {
+  *((size_t *)(segment + memorypa_u_char_p_size)) = amount;
+}
+
+static inline size_t memorypa_segment_get_amount(unsigned char *segment) {
+  return *((size_t *)(segment + memorypa_u_char_p_size));
+}
+
+static inline unsigned char * memorypa_segment_get_block_list(unsigned char *segment) {
+  return (unsigned char *)memorypa_round_up_to_block_alignment((size_t)(segment + memorypa_1st_1ucp));
+}
+
+/*
+  Returns the segment of a pool that holds the given block, or null if
+  the block isn't one of theirs (or doesn't sit on a block boundary).
+*/
+static inline unsigned char * memorypa_pool_find_segment(unsigned char *pool, unsigned char *block) {
+  size_t block_stride = memorypa_pool_get_block_stride(memorypa_pool_get_block_size(pool));
+  unsigned char *segment = memorypa_pool_get_segment_list(pool);
+  unsigned char *block_list;
+  while(segment != NULL) {
+    block_list = memorypa_segment_get_block_list(segment);
+    if(block >= block_list && block < block_list + (block_stride * memorypa_segment_get_amount(segment))) {
+      return (size_t)(block - block_list) % block_stride ? NULL : segment;
+    }
+    segment = memorypa_segment_get_next(segment);
+  }
+  return NULL;
+}
+
+/*
+  Size classes are kept in ascending order of their limit, i.e. the
+  largest size each of them serves:
+
+  size_t limit
+  unsigned char *pool
+*/
+static inline void memorypa_class_set(size_t size_class, size_t limit, unsigned char *pool) {
+  unsigned char *entry = memorypa_class_list + (size_class * memorypa_1st_1ucp);
+  *((size_t *)entry) = limit;
+  *((unsigned char **)(entry + memorypa_size_t_size)) = pool;
+}
+
+static inline size_t memorypa_class_get_limit(size_t size_class) {
+  return *((size_t *)(memorypa_class_list + (size_class * memorypa_1st_1ucp)));
+}
+
+static inline unsigned char * memorypa_class_get_pool(size_t size_class) {
+  return *((unsigned char **)(memorypa_class_list + (size_class * memorypa_1st_1ucp) + memorypa_size_t_size));
+}
+
+/*
+  Finds the pool holding the given address, or null when the address
+  lies outside all pools. Pools are laid out in the same ascending order
+  as the classes that point to them, so a binary search over the class
+  list finds the last pool starting at or before the address. Classes
+  without a pool only ever come last.
+*/
+static inline unsigned char * memorypa_pool_find(unsigned char *address) {
+  if(address < memorypa_everything + memorypa_pools_offset || address >= memorypa_everything + memorypa_everything_size) {
+    return NULL;
+  }
+  unsigned char *pool;
+  size_t low = 0;
+  size_t high = memorypa_class_count;
+  size_t middle;
+  while(high - low > 1) {
+    middle = (low + high) >> 1;
+    pool = memorypa_class_get_pool(middle);
+    if(pool != NULL && pool <= address) {
+      low = middle;
+    }
+    else {
+      high = middle;
+    }
+  }
+  return memorypa_class_get_pool(low);
+}
+
+/*
+  Header-less blocks have nowhere to keep the offset of aligned data. The
+  offset of pool data follows from the block stride, but rescued data
+  lives outside the pools. Those aligned rescued allocations are tracked
+  by a small open-addressing table from data to the given allocation:
+
+  {unsigned char *data, unsigned char *block} entries[1 << MEMORYPA_ALIGNED_TABLE_POWER]
+*/
+static inline size_t memorypa_aligned_table_get_home(unsigned char *data) {
+  return memorypa_mhash((size_t)data) >> (memorypa_size_t_bit_size - MEMORYPA_ALIGNED_TABLE_POWER);
+}
+
+static inline unsigned char ** memorypa_aligned_table_at(size_t index) {
+  return (unsigned char **)(memorypa_aligned_table + (index * memorypa_u_char_p_size * 2));
+}
+
+static inline unsigned char memorypa_aligned_table_set(unsigned char *data, unsigned char *block) {
+  size_t mask = (memorypa_one << MEMORYPA_ALIGNED_TABLE_POWER) - 1;
+  size_t index = memorypa_aligned_table_get_home(data);
+  size_t probes = 0;
+  unsigned char **entry;
+  memorypa_lock(&memorypa_aligned_table_lock);
+  do {
+    entry = memorypa_aligned_table_at(index);
+    if(entry[0] == NULL || entry[0] == data) {
+      entry[0] = data;
+      entry[1] = block;
+      memorypa_unlock(&memorypa_aligned_table_lock);
+      return 1;
+    }
+    index = (index + 1) & mask;
+  }
+  while(++probes <= mask);
+  memorypa_unlock(&memorypa_aligned_table_lock);
+  memorypa_write_message("memorypa: The aligned table is full!\n", MEMORYPA_WRITE_OPTION_STDERR);
+  return 0;
+}
+
+// Returns the data itself when it isn't in the table:
+static inline unsigned char * memorypa_aligned_table_get(unsigned char *data) {
+  size_t mask = (memorypa_one << MEMORYPA_ALIGNED_TABLE_POWER) - 1;
+  size_t index = memorypa_aligned_table_get_home(data);
+  size_t probes = 0;
+  unsigned char **entry;
+  memorypa_lock(&memorypa_aligned_table_lock);
+  do {
+    entry = memorypa_aligned_table_at(index);
+    if(entry[0] == data) {
+      data = entry[1];
+      break;
+    }
+    index = (index + 1) & mask;
+  }
+  while(entry[0] != NULL && ++probes <= mask);
+  memorypa_unlock(&memorypa_aligned_table_lock);
+  return data;
+}
+
+/*
+  Entries after the removed one shift back into the hole unless their
+  home lies cyclically between the hole and themselves, so lookups never
+  need tombstones.
+*/
+static inline void memorypa_aligned_table_remove(unsigned char *data) {
+  size_t mask = (memorypa_one << MEMORYPA_ALIGNED_TABLE_POWER) - 1;
+  size_t index = memorypa_aligned_table_get_home(data);
+  size_t probes = 0;
+  size_t next, home;
+  unsigned char **entry;
+  unsigned char **next_entry;
+  memorypa_lock(&memorypa_aligned_table_lock);
+  do {
+    entry = memorypa_aligned_table_at(index);
+    if(entry[0] == data) {
+      next = index;
+      while(1) {
+        next = (next + 1) & mask;
+        next_entry = memorypa_aligned_table_at(next);
+        if(next_entry[0] == NULL) {
+          break;
+        }
+        home = memorypa_aligned_table_get_home(next_entry[0]);
+        if(((next - home) & mask) >= ((next - index) & mask)) {
+          entry[0] = next_entry[0];
+          entry[1] = next_entry[1];
+          entry = next_entry;
+          index = next;
+        }
+      }
+      entry[0] = NULL;
+      entry[1] = NULL;
+      break;
+    }
+    index = (index + 1) & mask;
+  }
+  while(entry[0] != NULL && ++probes <= mask);
+  memorypa_unlock(&memorypa_aligned_table_lock);
+}
+
+static inline void memorypa_pool_block_set_pool(unsigned char *block, unsigned char *pool) {
+  if(!memorypa_headerless) {
+    *((unsigned char **)block) = pool;
+  }
+}
+
+static inline unsigned char * memorypa_pool_block_get_pool(unsigned char *block) {
+  if(memorypa_headerless) {
+    return memorypa_pool_find(block);
+  }
+  return *((unsigned char **)block);
+}
+
+static inline void memorypa_pool_block_set_terminator(unsigned char *block) {
+  if(memorypa_headerless) {
+    return;
+  }
+  block += memorypa_block_header_size - memorypa_2uc;
+  *block = 0;
+  block += memorypa_u_char_size;
+  *block = 0;
+}
+
+static inline unsigned short memorypa_pool_block_get_terminator(unsigned char *block) {
+  if(memorypa_headerless) {
+    return 0;
+  }
+  block += memorypa_block_header_size - memorypa_2uc;
+  unsigned short output = *block;
+  output <<= memorypa_u_char_bit_size;
+  block += memorypa_u_char_size;
+  output += *block;
+  return output;
+}
+
+static inline unsigned char * memorypa_pool_block_get_data(unsigned char *block) {
+  return block + memorypa_block_header_size;
+}
+
+/*
+  We have an unsigned short (only two bytes on normal computers) for
+  storing the alignment offset. Because I'm scared of endianness, this
+  function intentionally shifts and stores each byte in explicit
+  order. This guarantees that the terminator short is always zero when
+  the offset is small.
+*/
+static inline void memorypa_data_set_offset(unsigned char *data, unsigned short offset) {
+  data -= memorypa_2uc;
+  *data = (unsigned char)(offset >> memorypa_u_char_bit_size);
+  data += memorypa_u_char_size;
+  *data = (unsigned char)offset;
+}
+
+// Only fails when header-less rescued data doesn't fit in the aligned table:
+static inline unsigned char memorypa_pool_block_set_data_offset(unsigned char *data, unsigned short offset) {
+  if(memorypa_headerless) {
+    if(!offset || memorypa_pool_find(data) != NULL) {
+      return 1;
+    }
+    return memorypa_aligned_table_set(data, data - offset);
+  }
+  memorypa_data_set_offset(data, offset);
+  return 1;
+}
+
+static inline unsigned char * memorypa_pool_block_get_block_from_data(unsigned char *data) {
+  if(memorypa_headerless) {
+    unsigned char *pool = memorypa_pool_find(data);
+    if(pool == NULL) {
+      return memorypa_aligned_table_get(data);
+    }
+    unsigned char *block_list = memorypa_pool_get_block_list(pool);
+    size_t block_stride = memorypa_pool_get_block_stride(memorypa_pool_get_block_size(pool));
+    return block_list + (((size_t)(data - block_list) / block_stride) * block_stride);
+  }
+  data -= memorypa_2uc;
+  unsigned short offset = *data;
+  offset <<= memorypa_u_char_bit_size;
+  data += memorypa_u_char_size;
+  offset += *data;
+  // "1uc" instead of "2uc" because of the current value of "data":
+  data -= memorypa_block_header_size - memorypa_u_char_size;
+  data -= offset;
+  return data;
+}
+
+/*
+  Splits sizes into cells: one per size below "2 * MEMORYPA_STEPS_MAX",
+  then "MEMORYPA_STEPS_MAX" per power of 2 using the bits right below the
+  MSB. Classes are never narrower than a cell, so a cell only ever
+  straddles a couple of them.
+*/
+static inline size_t memorypa_class_cell(size_t size) {
+  if(size < (MEMORYPA_STEPS_MAX << 1)) {
+    return size;
+  }
+  size_t msb = memorypa_own_msb(size);
+  return ((msb - MEMORYPA_STEPS_MAX_SHIFT) << MEMORYPA_STEPS_MAX_SHIFT) + ((size >> (msb - 1 - MEMORYPA_STEPS_MAX_SHIFT)) & (MEMORYPA_STEPS_MAX - 1));
+}
+
+static inline size_t memorypa_class_cell_get_first_size(size_t cell) {
+  if(cell < (MEMORYPA_STEPS_MAX << 1)) {
+    return cell;
+  }
+  size_t msb = (cell >> MEMORYPA_STEPS_MAX_SHIFT) + MEMORYPA_STEPS_MAX_SHIFT;
+  return (memorypa_one << (msb - 1)) + ((cell & (MEMORYPA_STEPS_MAX - 1)) << (msb - 1 - MEMORYPA_STEPS_MAX_SHIFT));
+}
+
+/*
+  Returns the index of the size class that serves the given size. Each
+  cell holds the first class reaching its smallest size, and the last
+  class always reaches the maximum size.
+*/
+static inline size_t memorypa_own_route_by_class(size_t size) {
+  size_t size_class = memorypa_class_cells[memorypa_class_cell(size)];
+  while(memorypa_class_get_limit(size_class) < size) {
+    ++size_class;
+  }
+  return size_class;
+}
+
+/*
+  Small sizes skip the calculation above through a table built during
+  initialization. Each entry covers a step of consecutive sizes. Routing
+  never decreases as sizes grow, so when the first and last sizes of a
+  step share a class the whole step does. Steps that straddle two classes
+  (padding that isn't a multiple of the step, or tiny powers) are marked
+  and still go through the calculation.
+*/
+static inline size_t memorypa_own_route(size_t size) {
+  if(size <= MEMORYPA_ROUTE_TABLE_MAX_SIZE) {
+    unsigned short size_class = memorypa_route_table[size >> MEMORYPA_ROUTE_TABLE_STEP_SHIFT];
+    if(size_class != MEMORYPA_ROUTE_TABLE_STRADDLED) {
+      return size_class;
+    }
+  }
+  return memorypa_own_route_by_class(size);
+}
+
+static inline void memorypa_route_table_initialize() {
+  size_t cells = sizeof(memorypa_class_cells) / sizeof(memorypa_class_cells[0]);
+  size_t first_size;
+  size_t size_class = 0;
+  size_t i = 0;
+  do {
+    first_size = memorypa_class_cell_get_first_size(i);
+    while(memorypa_class_get_limit(size_class) < first_size) {
+      ++size_class;
+    }
+    memorypa_class_cells[i] = (unsigned short)size_class;
+  }
+  while(++i < cells);
+  size_t step_size = (size_t)1 << MEMORYPA_ROUTE_TABLE_STEP_SHIFT;
+  i = 0;
+  do {
+    size_class = memorypa_own_route_by_class(i * step_size);
+    if(size_class != memorypa_own_route_by_class((i * step_size) + step_size - 1)) {
+      size_class = MEMORYPA_ROUTE_TABLE_STRADDLED;
+    }
+    memorypa_route_table[i] = (unsigned short)size_class;
+  }
+  while(++i < MEMORYPA_ROUTE_TABLE_SIZE);
+}
+
+/*
+  The block's data may sit at any byte offset, so the link to the next
+  free block is copied in and out rather than dereferenced.
+*/
+static inline void memorypa_pool_free_block_set_next(unsigned char *block, unsigned char *next) {
+  memcpy(memorypa_pool_block_get_data(block), &next, memorypa_u_char_p_size);
+}
+
+static inline unsigned char * memorypa_pool_free_block_get_next(unsigned char *block) {
+  unsigned char *output;
+  memcpy(&output, memorypa_pool_block_get_data(block), memorypa_u_char_p_size);
+  return output;
+}
+
+static inline void memorypa_prefetch(unsigned char *address) {
+  #ifdef _MSC_VER
+  _mm_prefetch((const char *)address, _MM_HINT_T0);
+  #else
+  __builtin_prefetch(address, 1, 3);
+  #endif
+}
+
+/*
+  Lock-free pools reuse every slot of "free_block_list" as a link to the
+  next free block: that block's index plus one, with zero ending the
+  list. "free_block_head" packs the link to the first free block into its
+  low 32 bits and a tag into its high 32 bits. The tag changes with every
+  successful exchange, so a thread holding a stale head can never swap it
+  back in after other threads have popped and pushed the same block (the
+  ABA problem).
+*/
+static inline size_t memorypa_free_block_head_get_link(unsigned long long head) {
+  return (size_t)(head & 0xffffffffull);
+}
+
+static inline unsigned long long memorypa_free_block_head_replace_link(unsigned long long head, size_t link) {
+  return (((head >> 32) + 1) << 32) | link;
+}
+
+static inline size_t memorypa_pool_get_block_link(unsigned char *pool, unsigned char *block) {
+  return ((size_t)(block - memorypa_pool_get_block_list(pool)) / memorypa_pool_get_block_stride(memorypa_pool_get_block_size(pool))) + 1;
+}
+
+/*
+  Hands out up to "amount" blocks that were never used before, writing
+  their headers on the way. The caller must hold the pool's lock. The new
+  count is published only after the headers are written, so whoever reads
+  it atomically may trust every block below it. Slots of a regular free
+  block list get cleared too, so that everything below the count is
+  always initialized.
+*/
+static inline size_t memorypa_pool_carve_batch(unsigned char *pool, unsigned char **blocks, size_t amount) {
+  unsigned long long *carved_blocks = memorypa_pool_get_carved_blocks(pool);
+  unsigned long long current = memorypa_free_block_head_load(carved_blocks);
+  size_t carved = (size_t)current;
+  size_t block_amount = memorypa_pool_get_block_amount(pool);
+  if(amount > block_amount - carved) {
+    amount = block_amount - carved;
+  }
+  if(!amount) {
+    return 0;
+  }
+  unsigned char *block_list = memorypa_pool_get_block_list(pool);
+  size_t block_size = memorypa_pool_get_block_size(pool);
+  size_t i = 0;
+  do {
+    blocks[i] = memorypa_pool_block_list_at(block_list, block_size, carved + i);
+    memorypa_pool_block_set_pool(blocks[i], pool);
+    memorypa_pool_block_set_terminator(blocks[i]);
+  }
+  while(++i < amount);
+  if(memorypa_pool_get_free_list(pool) != MEMORYPA_FREE_LIST_INTRUSIVE && memorypa_pool_get_synchronization(pool) != MEMORYPA_SYNCHRONIZATION_LOCK_FREE) {
+    memset(memorypa_pool_free_block_list_at(memorypa_pool_get_free_block_list(pool), carved), 0, memorypa_u_char_p_size * amount);
+  }
+  // Nobody else carves while the lock is held, so a plain store publishes the blocks:
+  memorypa_free_block_head_store(carved_blocks, current + amount);
+  return amount;
+}
+
+/*
+  Lock-free pools only take their lock to carve, which happens at most
+  once per block. Fully carved pools don't even take it.
+*/
+static inline size_t memorypa_pool_lock_free_carve_batch(unsigned char *pool, unsigned char **blocks, size_t amount) {
+  if(memorypa_free_block_head_load(memorypa_pool_get_carved_blocks(pool)) >= memorypa_pool_get_block_amount(pool)) {
+    return 0;
+  }
+  memorypa_pool_lock(pool);
+  amount = memorypa_pool_carve_batch(pool, blocks, amount);
+  memorypa_pool_unlock(pool);
+  return amount;
+}
+
+static inline unsigned char * memorypa_pool_lock_free_allocate(unsigned char *pool) {
+  unsigned long long *head = memorypa_pool_get_free_block_head(pool);
+  unsigned char *free_block_list = memorypa_pool_get_free_block_list(pool);
+  unsigned long long current = memorypa_free_block_head_load(head);
+  size_t link;
+  size_t next_link;
+  do {
+    link = memorypa_free_block_head_get_link(current);
+    if(!link) {
+      unsigned char *output = NULL;
+      memorypa_pool_lock_free_carve_batch(pool, &output, 1);
+      return output;
+    }
+    next_link = memorypa_free_block_link_load(memorypa_pool_free_block_list_at(free_block_list, link - 1));
+  }
+  while(!memorypa_free_block_head_compare_exchange(head, &current, memorypa_free_block_head_replace_link(current, next_link)));
+  return memorypa_pool_block_list_at(memorypa_pool_get_block_list(pool), memorypa_pool_get_block_size(pool), link - 1);
+}
+
+/*
+  Pops up to "amount" blocks with a single exchange. The chain is walked
+  before the exchange, but the tag guarantees that the exchange only
+  succeeds if nobody touched the list in the meantime.
+*/
+static inline size_t memorypa_pool_lock_free_allocate_batch(unsigned char *pool, unsigned char **blocks, size_t amount) {
+  unsigned long long *head = memorypa_pool_get_free_block_head(pool);
+  unsigned char *free_block_list = memorypa_pool_get_free_block_list(pool);
+  unsigned char *block_list = memorypa_pool_get_block_list(pool);
+  size_t block_size = memorypa_pool_get_block_size(pool);
+  unsigned long long current = memorypa_free_block_head_load(head);
+  size_t link;
+  size_t count;
+  do {
+    count = 0;
+    link = memorypa_free_block_head_get_link(current);
+    while(link && count < amount) {
+      blocks[count++] = memorypa_pool_block_list_at(block_list, block_size, link - 1);
+      link = memorypa_free_block_link_load(memorypa_pool_free_block_list_at(free_block_list, link - 1));
+    }
+    if(!count) {
+      return memorypa_pool_lock_free_carve_batch(pool, blocks, amount);
+    }
+  }
+  while(!memorypa_free_block_head_compare_exchange(head, &current, memorypa_free_block_head_replace_link(current, link)));
+  return count;
+}
+
+/*
+  Chains the given blocks together privately, then pushes the whole chain
+  with a single exchange.
+*/
+static inline void memorypa_pool_lock_free_deallocate_batch(unsigned char *pool, unsigned char **blocks, size_t amount) {
+  unsigned long long *head = memorypa_pool_get_free_block_head(pool);
+  unsigned char *free_block_list = memorypa_pool_get_free_block_list(pool);
+  size_t first_link = memorypa_pool_get_block_link(pool, blocks[0]);
+  size_t last_link = first_link;
+  size_t link;
+  size_t i = 1;
+  while(i < amount) {
+    link = memorypa_pool_get_block_link(pool, blocks[i]);
+    memorypa_free_block_link_store(memorypa_pool_free_block_list_at(free_block_list, last_link - 1), link);
+    last_link = link;
+    ++i;
+  }
+  unsigned char *last_free_block = memorypa_pool_free_block_list_at(free_block_list, last_link - 1);
+  unsigned long long current = memorypa_free_block_head_load(head);
+  do {
+    memorypa_free_block_link_store(last_free_block, memorypa_free_block_head_get_link(current));
+  }
+  while(!memorypa_free_block_head_compare_exchange(head, &current, memorypa_free_block_head_replace_link(current, first_link)));
+}
+
+/*
+  Every thread that touches a pool with a cache gets its own copy of the
+  following, allocated with the given "malloc":
+
+  {size_t count, unsigned char *blocks[cache_amount]} caches[number of pools with a cache]
+
+  The caches are laid out in the same order as the pools, and each pool
+  remembers the position of its own cache.
+*/
+static inline size_t memorypa_thread_cache_get_total_size(size_t cache_amount) {
+  return memorypa_size_t_size + (memorypa_u_char_p_size * cache_amount);
+}
+
+static inline void memorypa_thread_cache_set_count(unsigned char *cache, size_t count) {
+  *((size_t *)cache) = count;
+}
+
+static inline size_t memorypa_thread_cache_get_count(unsigned char *cache) {
+  return *((size_t *)cache);
+}
+
+static inline unsigned char ** memorypa_thread_cache_get_blocks(unsigned char *cache) {
+  return (unsigned char **)(cache + memorypa_size_t_size);
+}
+
+/*
+  Per-CPU pools split their "amount" across the online CPUs. Each CPU
+  gets a slice of every such pool, laid out in the same order as the
+  pools, in front of the pools themselves:
+
+  {size_t count, unsigned char lock, unsigned char *blocks[amount / online CPUs]} slices[number of configured CPUs]
+  (each slice padded up to the next cache line)
+
+  A slice works just like a thread cache, except that whichever thread
+  runs on the CPU owns it. Its lock is only ever contended when a thread
+  gets preempted or migrates in the middle of an operation, so it stays
+  in the CPU's own cache. Threads never wait on it either: a busy slice
+  sends them straight to the pool, much like an aborted restartable
+  sequence would.
+*/
+static inline size_t memorypa_cpu_cache_get_total_size(size_t cache_amount) {
+  return memorypa_round_up_to_cache_line(memorypa_2st + (memorypa_u_char_p_size * cache_amount));
+}
+
+static inline size_t memorypa_pool_options_get_cpu_cache_amount(memorypa_pool_options *options) {
+  size_t cache_amount = options->amount / memorypa_cpu_online_count;
+  return cache_amount ? cache_amount : 1;
+}
+
+/*
+  Profiled allocations come from the given "malloc", behind a header:
+
+  size_t size
+  size_t site (only with "profile_sample_rate", 0 unless sampled)
+  (padding up to the block alignment, less the terminator)
+  unsigned short terminator (the offset of aligned data, see above)
+*/
+static inline void memorypa_profile_real_set_size(unsigned char *real, size_t size) {
+  *((size_t *)real) = size;
+}
+
+static inline size_t memorypa_profile_real_get_size(unsigned char *real) {
+  return *((size_t *)real);
+}
+
+static inline void memorypa_profile_real_set_site(unsigned char *real, size_t site) {
+  *(((size_t *)real) + 1) = site;
+}
+
+static inline size_t memorypa_profile_real_get_site(unsigned char *real) {
+  return *(((size_t *)real) + 1);
+}
+
+static inline void memorypa_profile_real_set_terminator(unsigned char *real) {
+  real += memorypa_profile_header_size - memorypa_2uc;
+  *real = 0;
+  real += memorypa_u_char_size;
+  *real = 0;
+}
+
+static inline unsigned short memorypa_profile_real_get_terminator(unsigned char *real) {
+  real += memorypa_profile_header_size - memorypa_2uc;
+  unsigned short output = *real;
+  output <<= memorypa_u_char_bit_size;
+  real += memorypa_u_char_size;
+  output += *real;
+  return output;
+}
+
+static inline unsigned char * memorypa_profile_real_get_data(unsigned char *real) {
+  return real + memorypa_profile_header_size;
+}
+
+static inline unsigned char * memorypa_profile_get_real_from_data(unsigned char *data) {
+  data -= memorypa_2uc;
+  unsigned short offset = *data;
+  offset <<= memorypa_u_char_bit_size;
+  data += memorypa_u_char_size;
+  offset += *data;
+  // "1uc" instead of "2uc" because of the current value of "data":
+  data -= memorypa_profile_header_size - memorypa_u_char_size;
+  data -= offset;
+  return data;
+}
+
+static inline unsigned char * memorypa_profile_allocate(size_t size) {
+  unsigned char *data = memorypa_given_malloc(memorypa_profile_header_size + size);
+  if(data != NULL) {
+    size_t size_class = memorypa_own_route(size);
+    memorypa_profile_real_set_size(data, size);
+    memorypa_profile_real_set_terminator(data);
+    memorypa_profile_increment(size_class);
+    if(memorypa_profile_histogram) {
+      memorypa_profile_record_size(size);
+    }
+    if(memorypa_profile_sample_rate) {
+      memorypa_profile_real_set_site(data, memorypa_profile_sample(size) ? memorypa_profile_site_record(size, memorypa_own_msb(memorypa_class_get_limit(size_class))) : 0);
+    }
+    data = memorypa_profile_real_get_data(data);
+  }
+  return data;
+}
+
+static inline void memorypa_profile_deallocate_real(unsigned char *real) {
+  memorypa_profile_decrement(memorypa_own_route(memorypa_profile_real_get_size(real)));
+  if(memorypa_profile_sample_rate && memorypa_profile_real_get_site(real)) {
+    memorypa_profile_site_release(memorypa_profile_real_get_site(real), memorypa_profile_real_get_size(real));
+  }
+  memorypa_given_free(real);
+}
+
+static inline unsigned char memorypa_pool_block_is_invalid(unsigned char *block, unsigned char *assigned_pool) {
+  // Header-less blocks find their pool by address:
+  if(memorypa_pool_block_get_pool(block) != assigned_pool) {
+    memorypa_write_message("memorypa: Block ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_hex((size_t)block, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" of pool ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_hex((size_t)assigned_pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" has the incorrect pool!\n", MEMORYPA_WRITE_OPTION_STDERR);
+    return 1;
+  }
+  if(memorypa_pool_block_get_terminator(block)) {
+    memorypa_write_message("memorypa: Block ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_hex((size_t)block, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" of pool ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_hex((size_t)assigned_pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" has an invalid terminator!\n", MEMORYPA_WRITE_OPTION_STDERR);
+    return 2;
+  }
+  return 0;
+}
+
+static inline unsigned char memorypa_pool_free_block_is_invalid(unsigned char *free_block, unsigned char *assigned_pool, size_t *free_blocks) {
+  unsigned char *block = memorypa_pool_free_block_get_block(free_block);
+  if(block != NULL) {
+    ++(*free_blocks);
+    return memorypa_pool_block_is_invalid(block, assigned_pool);
+  }
+  return 0;
+}
+
+static inline unsigned char memorypa_pool_is_invalid(unsigned char *pool, size_t *output_size) {
+  if(memorypa_pool_get_synchronization(pool) != MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK && memorypa_pool_lock_load(pool) > 1) {
+    memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" has invalid lock value!\n", MEMORYPA_WRITE_OPTION_STDERR);
+    return 1;
+  }
+  memorypa_pool_lock(pool);
+  size_t block_size = memorypa_pool_get_block_size(pool);
+  size_t block_padding = memorypa_pool_get_block_padding(pool);
+  size_t class_index = memorypa_pool_get_class_index(pool);
+  if(class_index >= memorypa_class_count || memorypa_class_get_pool(class_index) != pool || memorypa_class_get_limit(class_index) != block_size) {
+    memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" has invalid block size (", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_decimal(block_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(") and padding (", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_decimal(block_padding, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(")!\n", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_pool_unlock(pool);
+    return 2;
+  }
+  size_t block_amount = memorypa_pool_get_block_amount(pool);
+  unsigned char free_list = memorypa_pool_get_free_list(pool);
+  *output_size = memorypa_pool_get_total_size(block_size, block_amount, free_list);
+  size_t carved = (size_t)memorypa_free_block_head_load(memorypa_pool_get_carved_blocks(pool));
+  if(carved > block_amount) {
+    memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" has carved too many blocks!\n", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_pool_unlock(pool);
+    return 6;
+  }
+  size_t free_blocks = memorypa_pool_get_free_blocks(pool);
+  size_t counted_free_blocks = 0;
+  unsigned char *current_list = memorypa_pool_get_free_block_list(pool);
+  size_t i = 0;
+  if(memorypa_pool_get_synchronization(pool) == MEMORYPA_SYNCHRONIZATION_LOCK_FREE) {
+    /*
+      The lock doesn't hold off lock-free pools, so only walk a snapshot of
+      the free list and make sure that it stays inside the pool. Other
+      threads may change it in the meantime, so the walk is bounded and
+      there's no count to compare against.
+    */
+    i = memorypa_free_block_head_get_link(memorypa_free_block_head_load(memorypa_pool_get_free_block_head(pool)));
+    while(i && counted_free_blocks < block_amount) {
+      if(i > carved) {
+        memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
+        memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
+        memorypa_write_message(" has an invalid free block link!\n", MEMORYPA_WRITE_OPTION_STDERR);
+        memorypa_pool_unlock(pool);
+        return 3;
+      }
+      ++counted_free_blocks;
+      i = memorypa_free_block_link_load(memorypa_pool_free_block_list_at(current_list, i - 1));
+    }
+    counted_free_blocks = free_blocks;
+  }
+  else if(free_list == MEMORYPA_FREE_LIST_INTRUSIVE) {
+    // Make sure that every link stays inside the pool before following it:
+    unsigned char *block_list = memorypa_pool_get_block_list(pool);
+    size_t block_stride = memorypa_pool_get_block_stride(block_size);
+    unsigned char *current_block = memorypa_pool_get_free_block_top(pool);
+    size_t total_amount = block_amount;
+    unsigned char *segment = memorypa_pool_get_segment_list(pool);
+    while(segment != NULL) {
+      total_amount += memorypa_segment_get_amount(segment);
+      segment = memorypa_segment_get_next(segment);
+    }
+    while(current_block != NULL && counted_free_blocks <= total_amount) {
+      if((current_block < block_list || current_block >= block_list + (block_stride * carved) || (size_t)(current_block - block_list) % block_stride) && memorypa_pool_find_segment(pool, current_block) == NULL) {
+        memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
+        memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
+        memorypa_write_message(" has an invalid free block link!\n", MEMORYPA_WRITE_OPTION_STDERR);
+        memorypa_pool_unlock(pool);
+        return 3;
+      }
+      if(memorypa_pool_block_is_invalid(current_block, pool)) {
+        memorypa_pool_unlock(pool);
+        return 3;
+      }
+      ++counted_free_blocks;
+      current_block = memorypa_pool_free_block_get_next(current_block);
+    }
+  }
+  else {
+    while(i < carved) {
+      if(memorypa_pool_free_block_is_invalid(memorypa_pool_free_block_list_at(current_list, i), pool, &counted_free_blocks)) {
+        memorypa_pool_unlock(pool);
+        return 3;
+      }
+      ++i;
+    }
+  }
+  if(counted_free_blocks != free_blocks) {
+    memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" has invalid free block amount!\n", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_pool_unlock(pool);
+    return 4;
+  }
+  current_list = memorypa_pool_get_block_list(pool);
+  i = 0;
+  while(i < carved) {
+    if(memorypa_pool_block_is_invalid(memorypa_pool_block_list_at(current_list, block_size, i), pool)) {
+      memorypa_pool_unlock(pool);
+      return 5;
+    }
+    ++i;
+  }
+  unsigned char *current_segment = memorypa_pool_get_segment_list(pool);
+  size_t segment_count = 0;
+  while(current_segment != NULL) {
+    current_list = memorypa_segment_get_block_list(current_segment);
+    i = 0;
+    while(i < memorypa_segment_get_amount(current_segment)) {
+      if(memorypa_pool_block_is_invalid(memorypa_pool_block_list_at(current_list, block_size, i), pool)) {
+        memorypa_pool_unlock(pool);
+        return 5;
+      }
+      ++i;
+    }
+    ++segment_count;
+    current_segment = memorypa_segment_get_next(current_segment);
+  }
+  if(segment_count != memorypa_pool_get_segment_count(pool) || segment_count > memorypa_pool_get_segments(pool)) {
+    memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" has an invalid segment count!\n", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_pool_unlock(pool);
+    return 7;
+  }
+  memorypa_pool_unlock(pool);
+  return 0;
+}
+
+/*
+  Only writes the header. Blocks get carved on demand (see above), so the
+  time it takes doesn't depend on the amount of blocks.
+*/
+static inline void memorypa_pool_initialize(unsigned char *pool, memorypa_pool_options *options, size_t block_size, size_t cache_position, size_t class_index) {
+  size_t block_amount = options->amount;
+  unsigned char free_list = options->free_list;
+  memset(pool, 0, memorypa_2cl);
+  memorypa_pool_set_lock(pool);
+  memorypa_pool_set_synchronization(pool, options->synchronization);
+  memorypa_pool_set_block_size(pool, block_size);
+  memorypa_pool_set_block_padding(pool, options->padding);
+  memorypa_pool_set_block_amount(pool, block_amount);
+  memorypa_pool_set_free_blocks(pool, 0);
+  memorypa_pool_set_free_block_top(pool, NULL);
+  memorypa_pool_set_cache_amount(pool, options->per_cpu ? memorypa_pool_options_get_cpu_cache_amount(options) : options->cache);
+  memorypa_pool_set_cache_position(pool, cache_position);
+  memorypa_pool_set_class_index(pool, class_index);
+  memorypa_pool_set_free_list(pool, free_list);
+  memorypa_pool_set_prefetch(pool, options->prefetch);
+  memorypa_pool_set_per_cpu(pool, options->per_cpu);
+  memorypa_pool_set_segments(pool, options->segments);
+  // Lock-free pools can't hold off other threads while trimming:
+  memorypa_pool_set_trim(pool, options->synchronization != MEMORYPA_SYNCHRONIZATION_LOCK_FREE && memorypa_pool_get_block_stride(block_size) >= memorypa_pool_get_trim_offset(free_list) + (2 * memorypa_page_size));
+  memorypa_pool_set_block_list(pool, block_amount, free_list);
+}
+
+static inline void memorypa_pool_release_segments(unsigned char *pool) {
+  unsigned char *segment = memorypa_pool_get_segment_list(pool);
+  unsigned char *next;
+  while(segment != NULL) {
+    next = memorypa_segment_get_next(segment);
+    memorypa_given_free(segment);
+    segment = next;
+  }
+  memorypa_pool_set_segment_list(pool, NULL);
+  memorypa_pool_set_segment_count(pool, 0);
+}
+
+/*
+  Wipes everything a pool has ever written: its header, and the free
+  block list slots and blocks that were carved.
+*/
+static inline void memorypa_pool_clear(unsigned char *pool) {
+  size_t carved = (size_t)memorypa_free_block_head_load(memorypa_pool_get_carved_blocks(pool));
+  unsigned char *block_list = memorypa_pool_get_block_list(pool);
+  if(memorypa_pool_get_free_list(pool) != MEMORYPA_FREE_LIST_INTRUSIVE) {
+    memset(memorypa_pool_get_free_block_list(pool), 0, memorypa_u_char_p_size * carved);
+  }
+  memset(block_list, 0, memorypa_pool_get_block_stride(memorypa_pool_get_block_size(pool)) * carved);
+  memset(pool, 0, memorypa_2cl);
+}
+
+/*
+  The "k"th of the size classes that split the power of 2 of the given
+  options. E.g. the power 11 split in 4 steps serves up to 1279, 1535,
+  1791 and 2047 bytes, or exactly 1280, 1536, 1792 and 2048 bytes with
+  "exact". A single step covers the whole power like before.
+*/
+static inline size_t memorypa_pool_options_get_class_limit(memorypa_pool_options *options, size_t k) {
+  size_t half = memorypa_one << (options->power - 1);
+  size_t limit = half + (k * (half / options->steps)) + options->padding;
+  return options->exact ? limit : limit - 1;
+}
+
+/*
+  Maps the pools straight from the operating system on huge pages, so
+  that random access over a large region doesn't thrash the TLB. Explicit
+  huge pages come from the reserved pool ("MAP_HUGETLB" on Linux, large
+  pages on Windows) and are tried first. Otherwise, Linux gets a region
+  aligned to "MEMORYPA_HUGE_PAGE_SIZE" and is asked to back it with
+  transparent huge pages. Returns null when neither works out, in which
+  case the caller falls back to the given "malloc".
+*/
+static inline unsigned char * memorypa_everything_map(size_t size) {
+  #ifdef _MSC_VER
+  size_t page_size = (size_t)GetLargePageMinimum();
+  if(!page_size) {
+    return NULL;
+  }
+  size_t mapped_size = (size + page_size - 1) & ~(page_size - 1);
+  unsigned char *output = (unsigned char *)VirtualAlloc(NULL, mapped_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+  if(output == NULL) {
+    return NULL;
+  }
+  memorypa_huge_pages = MEMORYPA_HUGE_PAGES_EXPLICIT;
+  #else
+  size_t mapped_size = (size + MEMORYPA_HUGE_PAGE_SIZE - 1) & ~((size_t)MEMORYPA_HUGE_PAGE_SIZE - 1);
+  unsigned char *output;
+  #ifdef MAP_HUGETLB
+  output = (unsigned char *)mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if(output != MAP_FAILED) {
+    memorypa_huge_pages = MEMORYPA_HUGE_PAGES_EXPLICIT;
+    memorypa_everything_mapped_size = mapped_size;
+    return output;
+  }
+  #endif
+  #ifdef MADV_HUGEPAGE
+  // Map one huge page too many, then trim the region down to an aligned one:
+  unsigned char *given = (unsigned char *)mmap(NULL, mapped_size + MEMORYPA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(given == MAP_FAILED) {
+    return NULL;
+  }
+  output = given + ((MEMORYPA_HUGE_PAGE_SIZE - ((size_t)given & (MEMORYPA_HUGE_PAGE_SIZE - 1))) & (MEMORYPA_HUGE_PAGE_SIZE - 1));
+  if(output != given) {
+    munmap(given, (size_t)(output - given));
+  }
+  if(output + mapped_size != given + mapped_size + MEMORYPA_HUGE_PAGE_SIZE) {
+    munmap(output + mapped_size, (size_t)((given + mapped_size + MEMORYPA_HUGE_PAGE_SIZE) - (output + mapped_size)));
+  }
+  if(madvise(output, mapped_size, MADV_HUGEPAGE)) {
+    munmap(output, mapped_size);
+    return NULL;
+  }
+  memorypa_huge_pages = MEMORYPA_HUGE_PAGES_TRANSPARENT;
+  #else
+  return NULL;
+  #endif
+  #endif
+  memorypa_everything_mapped_size = mapped_size;
+  return output;
+}
+
+static inline void memorypa_everything_unmap() {
+  #ifdef _MSC_VER
+  VirtualFree(memorypa_everything, 0, MEM_RELEASE);
+  #else
+  munmap(memorypa_everything, memorypa_everything_mapped_size);
+  #endif
+  memorypa_everything_mapped_size = 0;
+  memorypa_huge_pages = MEMORYPA_HUGE_PAGES_NONE;
+}
+
+/*
+  Validates the options and counts the size classes before anything gets
+  allocated. Every power of 2 gets at least one class so that the profile
+  can tell them apart, plus one more for each extra step of a pool.
+  Counts the sets of options, and returns what's wrong with them, if
+  anything, for the caller to report.
+*/
+static inline const char * memorypa_pools_validate(memorypa_pool_options *sets_of_options, size_t *sets_of_options_size, size_t *class_bound) {
+  size_t i = 0;
+  size_t j = 0;
+  *sets_of_options_size = 0;
+  *class_bound = memorypa_size_t_bit_size;
+  while(i < memorypa_size_t_bit_size) {
+    j = i + 1;
+    if(sets_of_options[i].power) {
+      ++(*sets_of_options_size);
+      if(sets_of_options[i].power >= memorypa_size_t_bit_size) {
+        return "memorypa: Invalid options! Powers must be smaller than the number of bits in a machine word!\n";
+      }
+      if(j < memorypa_size_t_bit_size && sets_of_options[j].power && sets_of_options[i].power >= sets_of_options[j].power) {
+        return "memorypa: Invalid options! Specified powers must be unique and in ascending order!\n";
+      }
+      if(!sets_of_options[i].steps) {
+        sets_of_options[i].steps = 1;
+      }
+      if(sets_of_options[i].steps > MEMORYPA_STEPS_MAX || (sets_of_options[i].steps & (sets_of_options[i].steps - 1)) || (memorypa_one << (sets_of_options[i].power - 1)) < sets_of_options[i].steps) {
+        return "memorypa: Invalid options! Steps must be a power of 2 that splits the power evenly and doesn't exceed MEMORYPA_STEPS_MAX!\n";
+      }
+      *class_bound += sets_of_options[i].steps - 1;
+      if(sets_of_options[i].per_cpu) {
+        if(sets_of_options[i].cache) {
+          return "memorypa: Invalid options! Per-CPU pools can't have a thread cache too!\n";
+        }
+      }
+      if(sets_of_options[i].synchronization > MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK) {
+        return "memorypa: Invalid options! Unknown synchronization!\n";
+      }
+      // Links to free blocks must fit in the low half of "free_block_head":
+      if(sets_of_options[i].synchronization == MEMORYPA_SYNCHRONIZATION_LOCK_FREE && sets_of_options[i].amount >= 0xffffffffull) {
+        return "memorypa: Invalid options! Lock-free pools must have fewer than 4294967295 blocks!\n";
+      }
+      if(sets_of_options[i].free_list > MEMORYPA_FREE_LIST_INTRUSIVE) {
+        return "memorypa: Invalid options! Unknown free list!\n";
+      }
+      if(sets_of_options[i].free_list == MEMORYPA_FREE_LIST_INTRUSIVE) {
+        // A lock-free pop could read a link while the block's new owner overwrites it:
+        if(sets_of_options[i].synchronization == MEMORYPA_SYNCHRONIZATION_LOCK_FREE) {
+          return "memorypa: Invalid options! Intrusive free lists need a lock!\n";
+        }
+        if(memorypa_pool_options_get_class_limit(sets_of_options + i, 1) < memorypa_u_char_p_size) {
+          return "memorypa: Invalid options! Blocks of intrusive free lists must fit a pointer!\n";
+        }
+      }
+      if(sets_of_options[i].segments) {
+        // Other free lists can't take blocks from outside the pool:
+        if(sets_of_options[i].free_list != MEMORYPA_FREE_LIST_INTRUSIVE) {
+          return "memorypa: Invalid options! Growable pools need intrusive free lists!\n";
+        }
+        // Segments lie outside the range that header-less blocks are found by:
+        if(memorypa_headerless) {
+          return "memorypa: Invalid options! Growable pools need block headers!\n";
+        }
+        if(!sets_of_options[i].amount || sets_of_options[i].segments > MEMORYPA_SEGMENTS_MAX || ((sets_of_options[i].amount << sets_of_options[i].segments) >> sets_of_options[i].segments) != sets_of_options[i].amount) {
+          return "memorypa: Invalid options! Growable pools need some blocks to start with and at most MEMORYPA_SEGMENTS_MAX segments!\n";
+        }
+      }
+      // Padding must not let a class overtake the next one:
+      if(i && memorypa_pool_options_get_class_limit(sets_of_options + i, 1) <= sets_of_options[i - 1].own_block_size) {
+        return "memorypa: Invalid options! The padding of a pool overlaps the next power!\n";
+      }
+      sets_of_options[i].own_block_size = memorypa_pool_options_get_class_limit(sets_of_options + i, sets_of_options[i].steps);
+    }
+    else {
+      break;
+    }
+    i = j;
+  }
+  return NULL;
+}
+
+static inline void memorypa_pools_initialize(memorypa_pool_options *sets_of_options) {
+  size_t sets_of_options_size, class_bound;
+  const char *invalid = memorypa_pools_validate(sets_of_options, &sets_of_options_size, &class_bound);
+  if(invalid != NULL) {
+    memorypa_write_message(invalid, MEMORYPA_WRITE_OPTION_STDERR);
+    exit(EXIT_FAILURE);
+  }
+  size_t i = 0;
+  size_t j = 0;
+  size_t k = 0;
+  // Each class of a per-CPU pool gets a slice for every CPU:
+  memorypa_cpu_caches_size = 0;
+  while(i < sets_of_options_size) {
+    if(sets_of_options[i].per_cpu) {
+      memorypa_cpu_caches_size += sets_of_options[i].steps * memorypa_cpu_count * memorypa_cpu_cache_get_total_size(memorypa_pool_options_get_cpu_cache_amount(sets_of_options + i));
+    }
+    ++i;
+  }
+  memorypa_profile_shards_offset = class_bound * memorypa_1cl;
+  memorypa_profile_shard_size = memorypa_round_up_to_cache_line(class_bound * memorypa_size_t_size);
+  memorypa_profile_list_size = memorypa_profile_shards_offset + (memorypa_cpu_count * memorypa_profile_shard_size);
+  memorypa_class_list_size = class_bound * memorypa_1st_1ucp;
+  memorypa_aligned_table_size = memorypa_headerless ? (memorypa_one << MEMORYPA_ALIGNED_TABLE_POWER) * memorypa_u_char_p_size * 2 : 0;
+  memorypa_rescue_list_size = class_bound * memorypa_2st;
+  memorypa_profile_site_size = (8 + MEMORYPA_PROFILE_DEPTH) * memorypa_size_t_size;
+  memorypa_profile_site_list_size = memorypa_profile_sample_rate ? MEMORYPA_PROFILE_SITES * memorypa_profile_site_size : 0;
+  // The per-CPU slices and the pools themselves start on a cache line:
+  memorypa_pools_offset = memorypa_round_up_to_cache_line(memorypa_profile_list_size + memorypa_class_list_size + memorypa_aligned_table_size + memorypa_rescue_list_size + memorypa_profile_site_list_size) + memorypa_cpu_caches_size;
+  memorypa_everything_size = memorypa_pools_offset;
+  /*
+    Each class of a pool gets its own pool of "amount" blocks, laid out
+    one after the other.
+  */
+  i = 0;
+  while(i < sets_of_options_size) {
+    sets_of_options[i].own_size = 0;
+    k = 1;
+    do {
+      sets_of_options[i].own_size += memorypa_pool_get_total_size(memorypa_pool_options_get_class_limit(sets_of_options + i, k), sets_of_options[i].amount, sets_of_options[i].free_list);
+    }
+    while(++k <= sets_of_options[i].steps);
+    sets_of_options[i].own_relative_position = memorypa_everything_size;
+    memorypa_everything_size += sets_of_options[i].own_size;
+    ++i;
+  }
+  memorypa_everything = memorypa_huge_pages_requested ? memorypa_everything_map(memorypa_everything_size) : NULL;
+  if(memorypa_everything == NULL) {
+    // Leave room to align everything to a cache line:
+    memorypa_everything_given = memorypa_given_malloc(memorypa_everything_size + MEMORYPA_CACHE_LINE_SIZE - 1);
+    if(memorypa_everything_given == NULL) {
+      memorypa_write_message("memorypa: Cannot initialize any pools because the given \"malloc\" returned null!\n", MEMORYPA_WRITE_OPTION_STDERR);
+      exit(EXIT_FAILURE);
+    }
+    memorypa_everything = (unsigned char *)memorypa_round_up_to_cache_line((size_t)memorypa_everything_given);
+  }
+  // The pools zero out their own headers and nothing else, see above:
+  memset(memorypa_everything, 0, memorypa_pools_offset);
+  // Merely set the profile list (it's already zeroed out):
+  memorypa_profile_list = memorypa_everything;
+  // Prepare the class list:
+  memorypa_class_list = memorypa_everything + memorypa_profile_list_size;
+  // Merely set the aligned table too:
+  memorypa_aligned_table = memorypa_aligned_table_size ? memorypa_class_list + memorypa_class_list_size : NULL;
+  // The rescue counters:
+  memorypa_rescue_list = memorypa_class_list + memorypa_class_list_size + memorypa_aligned_table_size;
+  // The sampled sites:
+  memorypa_profile_site_list = memorypa_profile_site_list_size ? memorypa_rescue_list + memorypa_rescue_list_size : NULL;
+  // And the per-CPU slices:
+  memorypa_cpu_caches = memorypa_cpu_caches_size ? memorypa_everything + memorypa_pools_offset - memorypa_cpu_caches_size : NULL;
+  /*
+    Note that the whole strategy of this library is to divide memory
+    allocation along powers of 2, and to satisfy the requested size using
+    its most significant bit. E.g. if someone requests 124 bytes, its MSB
+    ("memorypa_own_msb" above) is 7 so a block from the pool of power 7 is
+    returned. Note that it's impossible for a number greater than 127 to
+    have an MSB of 7, so the block size of that pool is 127, not 128 as
+    one might expect (unless it's "exact").
+
+    Walk the powers in ascending order. A power with a pool adds each of
+    its classes. A power without one adds a single class served by the
+    next pool up, or by none if there's no such pool. This pattern allows
+    the user to minimize the number of pool options and allocate only as
+    many pools as needed. The last class always covers the maximum size
+    so that routing never runs off the list.
+
+    Pools with a cache get their own slice of every thread cache, laid
+    out in the same order as the pools themselves.
+  */
+  unsigned char *pool;
+  size_t limit;
+  size_t cpu_cache_position = 0;
+  memorypa_class_count = 0;
+  memorypa_thread_cache_size = 0;
+  i = 1;
+  j = 0;
+  while(i <= memorypa_size_t_bit_size) {
+    if(j < sets_of_options_size && sets_of_options[j].power == i) {
+      pool = memorypa_everything + sets_of_options[j].own_relative_position;
+      k = 1;
+      do {
+        limit = memorypa_pool_options_get_class_limit(sets_of_options + j, k);
+        memorypa_class_set(memorypa_class_count, limit, pool);
+        if(sets_of_options[j].per_cpu) {
+          memorypa_pool_initialize(pool, sets_of_options + j, limit, cpu_cache_position, memorypa_class_count);
+          cpu_cache_position += memorypa_cpu_count * memorypa_cpu_cache_get_total_size(memorypa_pool_options_get_cpu_cache_amount(sets_of_options + j));
+        }
+        else {
+          memorypa_pool_initialize(pool, sets_of_options + j, limit, memorypa_thread_cache_size, memorypa_class_count);
+          if(sets_of_options[j].cache) {
+            memorypa_thread_cache_size += memorypa_thread_cache_get_total_size(sets_of_options[j].cache);
+          }
+        }
+        pool += memorypa_pool_get_total_size(limit, sets_of_options[j].amount, sets_of_options[j].free_list);
+        ++memorypa_class_count;
+      }
+      while(++k <= sets_of_options[j].steps);
+      ++j;
+    }
+    else {
+      limit = i < memorypa_size_t_bit_size ? (memorypa_one << i) - 1 : ~(size_t)0;
+      // Padding below may already cover the whole power:
+      if(!memorypa_class_count || limit > memorypa_class_get_limit(memorypa_class_count - 1)) {
+        pool = j < sets_of_options_size ? memorypa_everything + sets_of_options[j].own_relative_position : NULL;
+        memorypa_class_set(memorypa_class_count, limit, pool);
+        ++memorypa_class_count;
+      }
+    }
+    ++i;
+  }
+}
+
+/*
+  Pools are sized for the peak, so the pages of free blocks stay resident
+  long after a burst. Trimming hands the pages inside free blocks back to
+  the operating system, keeping each block's header (and its link, in
+  intrusive pools) in place so that nothing else has to know. The pages
+  come back zeroed (or as they were, with "MADV_FREE") the next time the
+  block gets written. Only pools whose blocks span at least two pages
+  are trimmed at all, since smaller blocks rarely hold a whole page.
+
+  Free blocks leave from and return to the top of the free list, so the
+  "dirty_blocks" on top are the only ones freed since the last trim.
+  Everything below them was trimmed already and is left alone.
+*/
+static inline unsigned char memorypa_page_trim(unsigned char *address, size_t size) {
+  #ifdef _MSC_VER
+  return VirtualAlloc(address, size, MEM_RESET, PAGE_READWRITE) != NULL;
+  #else
+  #ifdef MADV_FREE
+  // Older kernels don't know about "MADV_FREE":
+  if(memorypa_trim_advice == MEMORYPA_TRIM_FREE && !madvise(address, size, MADV_FREE)) {
+    return 1;
+  }
+  #endif
+  return !madvise(address, size, MADV_DONTNEED);
+  #endif
+}
+
+static inline size_t memorypa_pool_block_trim(unsigned char *block, size_t block_stride, size_t trim_offset) {
+  size_t start = ((size_t)block + trim_offset + memorypa_page_size - 1) & ~(memorypa_page_size - 1);
+  size_t end = ((size_t)block + block_stride) & ~(memorypa_page_size - 1);
+  if(end <= start || !memorypa_page_trim((unsigned char *)start, end - start)) {
+    return 0;
+  }
+  return end - start;
+}
+
+// The caller must hold the pool's lock:
+static inline size_t memorypa_pool_trim(unsigned char *pool, size_t keep_blocks) {
+  size_t dirty_blocks = memorypa_pool_get_dirty_blocks(pool);
+  if(dirty_blocks <= keep_blocks) {
+    return 0;
+  }
+  unsigned char free_list = memorypa_pool_get_free_list(pool);
+  size_t block_stride = memorypa_pool_get_block_stride(memorypa_pool_get_block_size(pool));
+  size_t trim_offset = memorypa_pool_get_trim_offset(free_list);
+  size_t output = 0;
+  size_t i = 0;
+  if(free_list == MEMORYPA_FREE_LIST_INTRUSIVE) {
+    unsigned char *block = memorypa_pool_get_free_block_top(pool);
+    while(block != NULL && i < dirty_blocks) {
+      if(i >= keep_blocks) {
+        output += memorypa_pool_block_trim(block, block_stride, trim_offset);
+      }
+      block = memorypa_pool_free_block_get_next(block);
+      ++i;
+    }
+  }
+  else {
+    unsigned char *free_block_list = memorypa_pool_get_free_block_list(pool);
+    size_t free_blocks = memorypa_pool_get_free_blocks(pool);
+    i = free_blocks - dirty_blocks;
+    while(i < free_blocks - keep_blocks) {
+      output += memorypa_pool_block_trim(memorypa_pool_free_block_get_block(memorypa_pool_free_block_list_at(free_block_list, i)), block_stride, trim_offset);
+      ++i;
+    }
+  }
+  memorypa_pool_set_dirty_blocks(pool, keep_blocks);
+  return output;
+}
+
+/*
+  Blocks just returned to the top of the free list. With a threshold,
+  the pool trims itself down to half of it whenever its dirty free blocks
+  exceed it, so that the next few frees don't trim again right away.
+*/
+static inline void memorypa_pool_dirty_blocks(unsigned char *pool, size_t amount) {
+  size_t dirty_blocks = memorypa_pool_get_dirty_blocks(pool) + amount;
+  memorypa_pool_set_dirty_blocks(pool, dirty_blocks);
+  if(memorypa_trim_threshold && memorypa_pool_get_trim(pool)) {
+    size_t block_stride = memorypa_pool_get_block_stride(memorypa_pool_get_block_size(pool));
+    if(dirty_blocks * block_stride > memorypa_trim_threshold) {
+      memorypa_pool_trim(pool, (memorypa_trim_threshold / 2) / block_stride);
+    }
+  }
+}
+
+/*
+  Adds the next segment of a growable pool and pushes all its blocks onto
+  the free list. The caller must hold the pool's lock, and the free list
+  must be empty. The given "malloc" runs under the lock, but that only
+  happens a handful of times over the pool's lifetime.
+*/
+static inline unsigned char memorypa_pool_grow(unsigned char *pool) {
+  size_t segment_count = memorypa_pool_get_segment_count(pool);
+  if(segment_count >= memorypa_pool_get_segments(pool)) {
+    return 0;
+  }
+  size_t block_size = memorypa_pool_get_block_size(pool);
+  size_t amount = memorypa_pool_get_block_amount(pool) << segment_count;
+  unsigned char *segment = memorypa_given_malloc(memorypa_segment_get_total_size(block_size, amount));
+  if(segment == NULL) {
+    return 0;
+  }
+  memorypa_segment_set_next(segment, memorypa_pool_get_segment_list(pool));
+  memorypa_segment_set_amount(segment, amount);
+  memorypa_pool_set_segment_list(pool, segment);
+  memorypa_pool_set_segment_count(pool, segment_count + 1);
+  unsigned char *block_list = memorypa_segment_get_block_list(segment);
+  unsigned char *current_block;
+  unsigned char *previous_block = NULL;
+  size_t i = 0;
+  do {
+    current_block = memorypa_pool_block_list_at(block_list, block_size, i);
+    memorypa_pool_block_set_pool(current_block, pool);
+    memorypa_pool_block_set_terminator(current_block);
+    // The top ends up on the last block, so allocation walks the segment backwards:
+    memorypa_pool_free_block_set_next(current_block, previous_block);
+    previous_block = current_block;
+  }
+  while(++i < amount);
+  memorypa_pool_set_free_block_top(pool, previous_block);
+  memorypa_pool_set_free_blocks(pool, memorypa_pool_get_free_blocks(pool) + amount);
+  return 1;
+}
+
+static inline unsigned char * memorypa_pool_intrusive_allocate(unsigned char *pool) {
+  memorypa_pool_lock(pool);
+  unsigned char *output = memorypa_pool_get_free_block_top(pool);
+  if(output == NULL) {
+    if(memorypa_pool_carve_batch(pool, &output, 1) || !memorypa_pool_grow(pool)) {
+      memorypa_pool_unlock(pool);
+      return output;
+    }
+    output = memorypa_pool_get_free_block_top(pool);
+  }
+  unsigned char *next = memorypa_pool_free_block_get_next(output);
+  memorypa_pool_set_free_block_top(pool, next);
+  memorypa_pool_set_free_blocks(pool, memorypa_pool_get_free_blocks(pool) - 1);
+  memorypa_pool_clean_blocks(pool, 1);
+  if(next != NULL && memorypa_pool_get_prefetch(pool)) {
+    memorypa_prefetch(memorypa_pool_block_get_data(next));
+  }
+  memorypa_pool_unlock(pool);
+  return output;
+}
+
+static inline size_t memorypa_pool_intrusive_allocate_batch(unsigned char *pool, unsigned char **blocks, size_t amount) {
+  memorypa_pool_lock(pool);
+  unsigned char *current_block;
+  size_t count = 0;
+  size_t popped;
+  do {
+    current_block = memorypa_pool_get_free_block_top(pool);
+    popped = count;
+    while(current_block != NULL && count < amount) {
+      blocks[count++] = current_block;
+      current_block = memorypa_pool_free_block_get_next(current_block);
+    }
+    memorypa_pool_set_free_block_top(pool, current_block);
+    memorypa_pool_set_free_blocks(pool, memorypa_pool_get_free_blocks(pool) - (count - popped));
+    memorypa_pool_clean_blocks(pool, count - popped);
+    if(count < amount) {
+      count += memorypa_pool_carve_batch(pool, blocks + count, amount - count);
+    }
+  }
+  while(count < amount && memorypa_pool_grow(pool));
+  memorypa_pool_unlock(pool);
+  return count;
+}
+
+/*
+  Links the given blocks to each other outside the lock so that only the
+  last link and the top change under it.
+*/
+static inline void memorypa_pool_intrusive_deallocate_batch(unsigned char *pool, unsigned char **blocks, size_t amount) {
+  size_t i = 1;
+  while(i < amount) {
+    memorypa_pool_free_block_set_next(blocks[i], blocks[i - 1]);
+    ++i;
+  }
+  memorypa_pool_lock(pool);
+  memorypa_pool_free_block_set_next(blocks[0], memorypa_pool_get_free_block_top(pool));
+  memorypa_pool_set_free_block_top(pool, blocks[amount - 1]);
+  memorypa_pool_set_free_blocks(pool, memorypa_pool_get_free_blocks(pool) + amount);
+  memorypa_pool_dirty_blocks(pool, amount);
+  memorypa_pool_unlock(pool);
+}
+
+static inline unsigned char * memorypa_pool_allocate(unsigned char *pool) {
+  if(memorypa_pool_get_synchronization(pool) == MEMORYPA_SYNCHRONIZATION_LOCK_FREE) {
+    return memorypa_pool_lock_free_allocate(pool);
+  }
+  if(memorypa_pool_get_free_list(pool) == MEMORYPA_FREE_LIST_INTRUSIVE) {
+    return memorypa_pool_intrusive_allocate(pool);
+  }
+  unsigned char *output = NULL;
+  memorypa_pool_lock(pool);
+  size_t free_blocks = memorypa_pool_get_free_blocks(pool);
+  if(free_blocks) {
+    memorypa_pool_set_free_blocks(pool, --free_blocks);
+    memorypa_pool_clean_blocks(pool, 1);
+    unsigned char *free_block = memorypa_pool_get_free_block_list(pool);
+    free_block = memorypa_pool_free_block_list_at(free_block, free_blocks);
+    output = memorypa_pool_free_block_get_block(free_block);
+    memorypa_pool_free_block_set_block(free_block, NULL);
+    if(free_blocks && memorypa_pool_get_prefetch(pool)) {
+      memorypa_prefetch(memorypa_pool_block_get_data(memorypa_pool_free_block_get_block(free_block - memorypa_u_char_p_size)));
+    }
+  }
+  else {
+    memorypa_pool_carve_batch(pool, &output, 1);
+  }
+  memorypa_pool_unlock(pool);
+  return output;
+}
+
+/*
+  Running out of a pool (or missing one) used to be reported right away
+  with "write", which put a syscall on every rescued allocation exactly
+  when a program was already struggling. Instead, every rescue bumps the
+  counters of its class and leaves an event in a fixed ring:
+
+  size_t sequence
+  size_t site
+  size_t size_class
+  size_t size
+
+  Writers claim a ticket with a single atomic addition and never wait on
+  anyone. The ticket plus one becomes the sequence of the slot once the
+  other fields are in, and zero marks a slot that's being written. When
+  writers lap the reader, the oldest events are overwritten and counted
+  as dropped when drained. Only a zero makes the reader wait; a sequence
+  from an earlier lap is skipped as dropped, since a writer that stalled
+  for a whole lap may have stored it over a newer event for good. The counters are never dropped, so the
+  summary stays exact however many events the ring lost.
+*/
+static inline void memorypa_event_record(unsigned char site, size_t size_class, size_t size) {
+  size_t ticket = memorypa_event_fetch_add(&memorypa_events_head, 1);
+  size_t *slot = memorypa_events + ((ticket & (MEMORYPA_EVENTS_SIZE - 1)) << 2);
+  memorypa_event_store(slot, 0);
+  memorypa_event_fence();
+  memorypa_event_store(slot + 1, site);
+  memorypa_event_store(slot + 2, size_class);
+  memorypa_event_store(slot + 3, size);
+  memorypa_event_store(slot, ticket + 1);
+  if(memorypa_event_kinds[site] == MEMORYPA_EVENT_RESCUED_REALLOC) {
+    memorypa_event_fetch_add(&memorypa_events_rescued, 1);
+  }
+  else if(memorypa_rescue_list != NULL) {
+    memorypa_event_fetch_add((size_t *)(memorypa_rescue_list + (size_class * memorypa_2st) + (memorypa_event_kinds[site] == MEMORYPA_EVENT_NOT_INITIALIZED ? memorypa_size_t_size : 0)), 1);
+  }
+}
+
+static inline size_t memorypa_rescue_get_out_of_memory(size_t index) {
+  return memorypa_event_load((size_t *)(memorypa_rescue_list + (index * memorypa_2st)));
+}
+
+static inline size_t memorypa_rescue_get_not_initialized(size_t index) {
+  return memorypa_event_load((size_t *)(memorypa_rescue_list + (index * memorypa_2st) + memorypa_size_t_size));
+}
+
+static inline void memorypa_events_initialize() {
+  memset(memorypa_events, 0, sizeof(memorypa_events));
+  memorypa_events_head = 0;
+  memorypa_events_tail = 0;
+  memorypa_events_dropped = 0;
+  memorypa_events_rescued = 0;
+  memorypa_events_lock = 0;
+}
+
+/*
+  Rescued allocations of at least "memorypa_mapping_threshold" bytes get
+  a mapping of their own instead of going through the given "malloc".
+  Their block header points to "memorypa_mapped_pool", which is no pool
+  at all, and the size of the whole mapping sits right in front of it:
+
+  size_t mapping_size
+  (padding up to the block alignment)
+  {unsigned char *pool, unsigned char terminator[2], unsigned char data[]} block
+
+  On Linux, "mremap" resizes the mapping by moving its pages around, so
+  growing one never copies the data. Header-less blocks have no header to
+  point anywhere, so they always go through the given "malloc".
+*/
+static inline unsigned char * memorypa_mapping_map(size_t size) {
+  #ifdef _MSC_VER
+  return (unsigned char *)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  #else
+  void *output = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return output == MAP_FAILED ? NULL : (unsigned char *)output;
+  #endif
+}
+
+static inline void memorypa_mapping_unmap(unsigned char *mapping, size_t size) {
+  #ifdef _MSC_VER
+  (void)size;
+  VirtualFree(mapping, 0, MEM_RELEASE);
+  #else
+  munmap(mapping, size);
+  #endif
+}
+
+// Returns zero when the total would overflow:
+static inline size_t memorypa_mapping_get_total_size(size_t size) {
+  size_t header_size = memorypa_mapping_header_size + memorypa_block_header_size + memorypa_page_size - 1;
+  if(size > ((size_t)-1) - header_size) {
+    return 0;
+  }
+  return (header_size + size) & ~(memorypa_page_size - 1);
+}
+
+static inline size_t memorypa_mapping_get_size(unsigned char *block) {
+  return *((size_t *)(block - memorypa_mapping_header_size));
+}
+
+static inline unsigned char memorypa_mapping_serves(size_t size) {
+  return size >= memorypa_mapping_threshold;
+}
+
+static inline unsigned char * memorypa_mapping_allocate(size_t size) {
+  size_t total_size = memorypa_mapping_get_total_size(size);
+  unsigned char *mapping = total_size ? memorypa_mapping_map(total_size) : NULL;
+  if(mapping == NULL) {
+    return NULL;
+  }
+  *((size_t *)mapping) = total_size;
+  mapping += memorypa_mapping_header_size;
+  memorypa_pool_block_set_pool(mapping, &memorypa_mapped_pool);
+  memorypa_pool_block_set_terminator(mapping);
+  return mapping;
+}
+
+// The block keeps its header, so the result is the block too:
+static inline unsigned char * memorypa_mapping_reallocate(unsigned char *block, size_t new_size) {
+  unsigned char *mapping = block - memorypa_mapping_header_size;
+  size_t size = *((size_t *)mapping);
+  size_t total_size = memorypa_mapping_get_total_size(new_size);
+  if(!total_size) {
+    return NULL;
+  }
+  if(total_size == size) {
+    return block;
+  }
+  #ifdef __linux__
+  void *new_mapping = mremap(mapping, size, total_size, MREMAP_MAYMOVE);
+  if(new_mapping == MAP_FAILED) {
+    return NULL;
+  }
+  mapping = (unsigned char *)new_mapping;
+  #else
+  unsigned char *new_mapping = memorypa_mapping_map(total_size);
+  if(new_mapping == NULL) {
+    return NULL;
+  }
+  memcpy(new_mapping, mapping, size < total_size ? size : total_size);
+  memorypa_mapping_unmap(mapping, size);
+  mapping = new_mapping;
+  #endif
+  *((size_t *)mapping) = total_size;
+  return mapping + memorypa_mapping_header_size;
+}
+
+static inline void memorypa_mapping_deallocate(unsigned char *block) {
+  memorypa_mapping_unmap(block - memorypa_mapping_header_size, memorypa_mapping_get_size(block));
+}
+
+static inline unsigned char * memorypa_rescue_allocate_for_data(size_t size) {
+  if(memorypa_mapping_serves(size)) {
+    unsigned char *block = memorypa_mapping_allocate(size);
+    return block == NULL ? NULL : memorypa_pool_block_get_data(block);
+  }
+  unsigned char *output = memorypa_given_malloc(memorypa_block_header_size + size);
+  if(output != NULL) {
+    memorypa_pool_block_set_pool(output, NULL);
+    memorypa_pool_block_set_terminator(output);
+    output = memorypa_pool_block_get_data(output);
+  }
+  return output;
+}
+
+static inline unsigned char * memorypa_rescue_reallocate_for_default_data(unsigned char *block, size_t new_size) {
+  unsigned char *output = memorypa_pool_block_get_pool(block) == &memorypa_mapped_pool ? memorypa_mapping_reallocate(block, new_size) : memorypa_given_realloc(block, memorypa_block_header_size + new_size);
+  if(output != NULL) {
+    output = memorypa_pool_block_get_data(output);
+  }
+  return output;
+}
+
+static inline unsigned char * memorypa_rescue_reallocate_for_data(unsigned char *block, size_t new_size, size_t offset) {
+  unsigned char *output = memorypa_pool_block_get_pool(block) == &memorypa_mapped_pool ? memorypa_mapping_reallocate(block, new_size + offset) : memorypa_given_realloc(block, memorypa_block_header_size + new_size + offset);
+  if(output != NULL) {
+    output = memorypa_pool_block_get_data(output) + offset;
+    // Header-less data only moves in the aligned table once "realloc" succeeds:
+    if(memorypa_headerless && offset) {
+      memorypa_aligned_table_remove(block + offset);
+      memorypa_aligned_table_set(output, output - offset);
+    }
+  }
+  return output;
+}
+
+// The pool must be the block's own:
+static inline void memorypa_pool_deallocate_to_pool(unsigned char *pool, unsigned char *block) {
+  if(memorypa_pool_get_synchronization(pool) == MEMORYPA_SYNCHRONIZATION_LOCK_FREE) {
+    memorypa_pool_lock_free_deallocate_batch(pool, &block, 1);
+  }
+  else if(memorypa_pool_get_free_list(pool) == MEMORYPA_FREE_LIST_INTRUSIVE) {
+    memorypa_pool_intrusive_deallocate_batch(pool, &block, 1);
+  }
+  else {
+    memorypa_pool_lock(pool);
+    size_t free_blocks = memorypa_pool_get_free_blocks(pool);
+    unsigned char *free_block = memorypa_pool_get_free_block_list(pool);
+    free_block = memorypa_pool_free_block_list_at(free_block, free_blocks);
+    memorypa_pool_free_block_set_block(free_block, block);
+    memorypa_pool_set_free_blocks(pool, ++free_blocks);
+    memorypa_pool_dirty_blocks(pool, 1);
+    memorypa_pool_unlock(pool);
+  }
+}
+
+static inline void memorypa_pool_deallocate(unsigned char *block) {
+  unsigned char *pool = memorypa_pool_block_get_pool(block);
+  if(pool == NULL) {
+    memorypa_given_free(block);
+  }
+  else if(pool == &memorypa_mapped_pool) {
+    memorypa_mapping_deallocate(block);
+  }
+  else {
+    memorypa_pool_deallocate_to_pool(pool, block);
+  }
+}
+
+/*
+  The batch functions move a run of blocks between the free block list
+  and a plain array with a single lock acquisition. Blocks always leave
+  from and return to the top of the free block list.
+*/
+static inline size_t memorypa_pool_allocate_batch(unsigned char *pool, unsigned char **blocks, size_t amount) {
+  if(memorypa_pool_get_synchronization(pool) == MEMORYPA_SYNCHRONIZATION_LOCK_FREE) {
+    return memorypa_pool_lock_free_allocate_batch(pool, blocks, amount);
+  }
+  if(memorypa_pool_get_free_list(pool) == MEMORYPA_FREE_LIST_INTRUSIVE) {
+    return memorypa_pool_intrusive_allocate_batch(pool, blocks, amount);
+  }
+  memorypa_pool_lock(pool);
+  size_t free_blocks = memorypa_pool_get_free_blocks(pool);
+  size_t count = amount > free_blocks ? free_blocks : amount;
+  if(count) {
+    free_blocks -= count;
+    unsigned char *free_block = memorypa_pool_get_free_block_list(pool);
+    free_block = memorypa_pool_free_block_list_at(free_block, free_blocks);
+    memcpy(blocks, free_block, memorypa_u_char_p_size * count);
+    memset(free_block, 0, memorypa_u_char_p_size * count);
+    memorypa_pool_set_free_blocks(pool, free_blocks);
+    memorypa_pool_clean_blocks(pool, count);
+  }
+  if(count < amount) {
+    count += memorypa_pool_carve_batch(pool, blocks + count, amount - count);
+  }
+  memorypa_pool_unlock(pool);
+  return count;
+}
+
+static inline void memorypa_pool_deallocate_batch(unsigned char *pool, unsigned char **blocks, size_t amount) {
+  if(memorypa_pool_get_synchronization(pool) == MEMORYPA_SYNCHRONIZATION_LOCK_FREE) {
+    memorypa_pool_lock_free_deallocate_batch(pool, blocks, amount);
+    return;
+  }
+  if(memorypa_pool_get_free_list(pool) == MEMORYPA_FREE_LIST_INTRUSIVE) {
+    memorypa_pool_intrusive_deallocate_batch(pool, blocks, amount);
+    return;
+  }
+  memorypa_pool_lock(pool);
+  size_t free_blocks = memorypa_pool_get_free_blocks(pool);
+  unsigned char *free_block = memorypa_pool_get_free_block_list(pool);
+  free_block = memorypa_pool_free_block_list_at(free_block, free_blocks);
+  memcpy(free_block, blocks, memorypa_u_char_p_size * amount);
+  memorypa_pool_set_free_blocks(pool, free_blocks + amount);
+  memorypa_pool_dirty_blocks(pool, amount);
+  memorypa_pool_unlock(pool);
+}
+
+static void memorypa_thread_cache_release(unsigned char *thread_cache) {
+  unsigned char *previous = NULL;
+  unsigned char *pool;
+  unsigned char *cache;
+  size_t count;
+  size_t i = 0;
+  do {
+    pool = memorypa_class_get_pool(i);
+    if(pool != NULL && pool != previous) {
+      previous = pool;
+      if(memorypa_pool_get_cache_amount(pool) && !memorypa_pool_get_per_cpu(pool)) {
+        cache = thread_cache + memorypa_pool_get_cache_position(pool);
+        count = memorypa_thread_cache_get_count(cache);
+        if(count) {
+          memorypa_pool_deallocate_batch(pool, memorypa_thread_cache_get_blocks(cache), count);
+          memorypa_thread_cache_set_count(cache, 0);
+        }
+      }
+    }
+  }
+  while(++i < memorypa_class_count);
+}
+
+/*
+  Frees this thread's cache outside of its exit. The key lets go of it
+  first, or the exit would free it again.
+*/
+static inline void memorypa_thread_cache_discard() {
+  #ifdef _MSC_VER
+  FlsSetValue(memorypa_thread_cache_key, NULL);
+  #else
+  pthread_setspecific(memorypa_thread_cache_key, NULL);
+  #endif
+  memorypa_given_free(memorypa_thread_cache);
+  memorypa_thread_cache = NULL;
+}
+
+/*
+  Called by the operating system when a thread that owns a cache
+  exits. Every cached block goes back to its pool, unless the pools were
+  destroyed since the cache was created.
+*/
+#ifdef _MSC_VER
+static void WINAPI memorypa_thread_cache_destroy(void *thread_cache) {
+#else
+static void memorypa_thread_cache_destroy(void *thread_cache) {
+#endif
+  // Whatever this thread allocates from here on bypasses the cache:
+  memorypa_thread_cache_unavailable = 1;
+  if(memorypa_thread_cache_generation == memorypa_generation && memorypa_lock_load(&memorypa_initialized)) {
+    memorypa_thread_cache_release((unsigned char *)thread_cache);
+  }
+  memorypa_thread_cache = NULL;
+  memorypa_given_free(thread_cache);
+}
+
+static unsigned char * memorypa_thread_cache_create() {
+  if(memorypa_thread_cache_unavailable) {
+    return NULL;
+  }
+  // Registering the cache may allocate, so bypass the cache until done:
+  memorypa_thread_cache_unavailable = 1;
+  if(memorypa_thread_cache != NULL) {
+    // This cache belongs to pools that have since been destroyed:
+    memorypa_thread_cache_discard();
+  }
+  unsigned char *thread_cache = memorypa_given_malloc(memorypa_thread_cache_size);
+  if(thread_cache != NULL) {
+    memset(thread_cache, 0, memorypa_thread_cache_size);
+    #ifdef _MSC_VER
+    if(FlsSetValue(memorypa_thread_cache_key, thread_cache)) {
+    #else
+    if(!pthread_setspecific(memorypa_thread_cache_key, thread_cache)) {
+    #endif
+      memorypa_thread_cache = thread_cache;
+      memorypa_thread_cache_generation = memorypa_generation;
+      memorypa_thread_cache_unavailable = 0;
+    }
+    else {
+      memorypa_given_free(thread_cache);
+      thread_cache = NULL;
+    }
+  }
+  return thread_cache;
+}
+
+static inline unsigned char * memorypa_thread_cache_get() {
+  if(memorypa_thread_cache != NULL && memorypa_thread_cache_generation == memorypa_generation) {
+    return memorypa_thread_cache;
+  }
+  return memorypa_thread_cache_create();
+}
+
+static inline unsigned char * memorypa_cpu_cache_get(unsigned char *pool, size_t cache_amount) {
+  size_t cpu = memorypa_own_get_cpu();
+  if(cpu >= memorypa_cpu_count) {
+    cpu %= memorypa_cpu_count;
+  }
+  return memorypa_cpu_caches + memorypa_pool_get_cache_position(pool) + (cpu * memorypa_cpu_cache_get_total_size(cache_amount));
+}
+
+static inline void memorypa_cpu_cache_set_count(unsigned char *cache, size_t count) {
+  *((size_t *)cache) = count;
+}
+
+static inline size_t memorypa_cpu_cache_get_count(unsigned char *cache) {
+  return *((size_t *)cache);
+}
+
+static inline unsigned char * memorypa_cpu_cache_get_lock(unsigned char *cache) {
+  return cache + memorypa_size_t_size;
+}
+
+static inline unsigned char ** memorypa_cpu_cache_get_blocks(unsigned char *cache) {
+  return (unsigned char **)(cache + memorypa_2st);
+}
+
+static inline unsigned char * memorypa_cpu_cache_allocate(unsigned char *pool, size_t cache_amount) {
+  unsigned char *cache = memorypa_cpu_cache_get(pool, cache_amount);
+  unsigned char **blocks = memorypa_cpu_cache_get_blocks(cache);
+  unsigned char *output = NULL;
+  if(memorypa_lock_test_set(memorypa_cpu_cache_get_lock(cache))) {
+    return memorypa_pool_allocate(pool);
+  }
+  size_t count = memorypa_cpu_cache_get_count(cache);
+  if(!count) {
+    count = memorypa_pool_allocate_batch(pool, blocks, (cache_amount + 1) >> 1);
+  }
+  if(count) {
+    memorypa_cpu_cache_set_count(cache, --count);
+    output = blocks[count];
+  }
+  memorypa_unlock(memorypa_cpu_cache_get_lock(cache));
+  return output;
+}
+
+static inline void memorypa_cpu_cache_deallocate(unsigned char *pool, unsigned char *block, size_t cache_amount) {
+  unsigned char *cache = memorypa_cpu_cache_get(pool, cache_amount);
+  unsigned char **blocks = memorypa_cpu_cache_get_blocks(cache);
+  if(memorypa_lock_test_set(memorypa_cpu_cache_get_lock(cache))) {
+    memorypa_pool_deallocate_to_pool(pool, block);
+    return;
+  }
+  size_t count = memorypa_cpu_cache_get_count(cache);
+  if(count == cache_amount) {
+    size_t flushed = (cache_amount + 1) >> 1;
+    memorypa_pool_deallocate_batch(pool, blocks, flushed);
+    count -= flushed;
+    memmove(blocks, blocks + flushed, memorypa_u_char_p_size * count);
+  }
+  blocks[count] = block;
+  memorypa_cpu_cache_set_count(cache, count + 1);
+  memorypa_unlock(memorypa_cpu_cache_get_lock(cache));
+}
+
+/*
+  The thread cache sits in front of "memorypa_pool_allocate" and
+  "memorypa_pool_deallocate". Hits are plain loads and stores on memory
+  owned by the current thread. A miss refills half the cache, and a full
+  cache flushes its older half, each with a single lock acquisition.
+*/
+static inline unsigned char * memorypa_thread_cache_allocate(unsigned char *pool) {
+  size_t cache_amount = memorypa_pool_get_cache_amount(pool);
+  if(cache_amount) {
+    if(memorypa_pool_get_per_cpu(pool)) {
+      return memorypa_cpu_cache_allocate(pool, cache_amount);
+    }
+    unsigned char *cache = memorypa_thread_cache_get();
+    if(cache != NULL) {
+      cache += memorypa_pool_get_cache_position(pool);
+      unsigned char **blocks = memorypa_thread_cache_get_blocks(cache);
+      size_t count = memorypa_thread_cache_get_count(cache);
+      if(!count) {
+        count = memorypa_pool_allocate_batch(pool, blocks, (cache_amount + 1) >> 1);
+        if(!count) {
+          return NULL;
+        }
+      }
+      memorypa_thread_cache_set_count(cache, --count);
+      return blocks[count];
+    }
+  }
+  return memorypa_pool_allocate(pool);
+}
+
+// The pool must be the block's own:
+static inline void memorypa_thread_cache_deallocate_to_pool(unsigned char *pool, unsigned char *block) {
+  size_t cache_amount = memorypa_pool_get_cache_amount(pool);
+  if(cache_amount) {
+    if(memorypa_pool_get_per_cpu(pool)) {
+      memorypa_cpu_cache_deallocate(pool, block, cache_amount);
+      return;
+    }
+    unsigned char *cache = memorypa_thread_cache_get();
+    if(cache != NULL) {
+      cache += memorypa_pool_get_cache_position(pool);
+      unsigned char **blocks = memorypa_thread_cache_get_blocks(cache);
+      size_t count = memorypa_thread_cache_get_count(cache);
+      if(count == cache_amount) {
+        size_t flushed = (cache_amount + 1) >> 1;
+        memorypa_pool_deallocate_batch(pool, blocks, flushed);
+        count -= flushed;
+        memmove(blocks, blocks + flushed, memorypa_u_char_p_size * count);
+      }
+      blocks[count] = block;
+      memorypa_thread_cache_set_count(cache, count + 1);
+      return;
+    }
+  }
+  memorypa_pool_deallocate_to_pool(pool, block);
+}
+
+static inline void memorypa_thread_cache_deallocate(unsigned char *block) {
+  unsigned char *pool = memorypa_pool_block_get_pool(block);
+  if(pool != NULL && pool != &memorypa_mapped_pool) {
+    memorypa_thread_cache_deallocate_to_pool(pool, block);
+  }
+  else {
+    memorypa_pool_deallocate(block);
+  }
+}
+
+static inline void memorypa_thread_cache_initialize() {
+  // Invalidates the thread caches of any previously destroyed pools:
+  ++memorypa_generation;
+  if(memorypa_thread_cache_size && !memorypa_thread_cache_key_created) {
+    #ifdef _MSC_VER
+    memorypa_thread_cache_key = FlsAlloc(memorypa_thread_cache_destroy);
+    if(memorypa_thread_cache_key == FLS_OUT_OF_INDEXES) {
+    #else
+    if(pthread_key_create(&memorypa_thread_cache_key, memorypa_thread_cache_destroy)) {
+    #endif
+      memorypa_write_message("memorypa: Cannot create the key for thread caches!\n", MEMORYPA_WRITE_OPTION_STDERR);
+      exit(EXIT_FAILURE);
+    }
+    memorypa_thread_cache_key_created = 1;
+  }
+}
+
+static inline unsigned char * memorypa_own_malloc(size_t size) {
+  unsigned char *output = NULL;
+  size_t size_class = memorypa_own_route(size);
+  unsigned char *pool = memorypa_class_get_pool(size_class);
+  if(pool != NULL) {
+    if((output = memorypa_thread_cache_allocate(pool)) != NULL) {
+      output = memorypa_pool_block_get_data(output);
+    }
+    else {
+      output = memorypa_rescue_allocate_for_data(size);
+      memorypa_event_record(1, size_class, size);
+    }
+  }
+  else {
+    output = memorypa_rescue_allocate_for_data(size);
+    // Sizes beyond every pool are expected to be mapped:
+    if(!memorypa_mapping_serves(size)) {
+      memorypa_event_record(2, size_class, size);
+    }
+  }
+  return output;
+}
+
+/*
+  Routes once and takes all the blocks it can from the pool with a
+  single lock acquisition, straight into "output". The blocks are then
+  turned into data in place, and whatever the pool couldn't provide gets
+  rescued one by one. Thread caches and per-CPU slices are bypassed, but
+  the blocks may be freed through them like any other.
+*/
+static inline size_t memorypa_own_malloc_batch(size_t size, size_t amount, unsigned char **output) {
+  size_t size_class = memorypa_own_route(size);
+  unsigned char *pool = memorypa_class_get_pool(size_class);
+  size_t count = 0;
+  if(pool != NULL && amount) {
+    count = memorypa_pool_allocate_batch(pool, output, amount);
+    size_t i = 0;
+    while(i < count) {
+      output[i] = memorypa_pool_block_get_data(output[i]);
+      ++i;
+    }
+  }
+  while(count < amount) {
+    if((output[count] = memorypa_own_malloc(size)) == NULL) {
+      break;
+    }
+    ++count;
+  }
+  return count;
+}
+
+static inline unsigned char * memorypa_own_aligned_malloc(size_t size, unsigned short alignment) {
+  // Every block is already aligned this much:
+  if(alignment <= memorypa_block_alignment) {
+    return memorypa_own_malloc(size);
+  }
+  unsigned char *data = memorypa_own_malloc(size + alignment - 1);
+  if(data != NULL) {
+    size_t offset = (size_t)data & (alignment - 1);
+    if(offset) {
+      offset = alignment - offset;
+      data += offset;
+      if(!memorypa_pool_block_set_data_offset(data, (unsigned short)offset)) {
+        memorypa_given_free(data - offset);
+        return NULL;
+      }
+    }
+  }
+  return data;
+}
+
+static inline unsigned char * memorypa_own_calloc(size_t amount, size_t unit_size) {
+  size_t size = amount * unit_size;
+  unsigned char *data = memorypa_own_malloc(size);
+  if(data != NULL) {
+    memset(data, 0, size);
+  }
+  return data;
+}
+
+static inline unsigned char * memorypa_own_aligned_calloc(size_t amount, size_t unit_size, unsigned short alignment) {
+  size_t size = amount * unit_size;
+  unsigned char *data = memorypa_own_aligned_malloc(size, alignment);
+  if(data != NULL) {
+    memset(data, 0, size);
+  }
+  return data;
+}
+
+static inline void memorypa_own_free(unsigned char *data) {
+  // The spec allows "NULL" to be passed without failure:
+  if(data != NULL) {
+    unsigned char *block = memorypa_pool_block_get_block_from_data(data);
+    // Header-less blocks that were aligned outside the pools are only known to the aligned table:
+    if(memorypa_headerless && block != data && memorypa_pool_find(data) == NULL) {
+      memorypa_aligned_table_remove(data);
+    }
+    memorypa_thread_cache_deallocate(block);
+  }
+}
+
+/*
+  Gathers up to "MEMORYPA_BATCH_SIZE" blocks, sorts them by pool with an
+  insertion sort (the window is small and usually nearly sorted already),
+  and returns each pool's share with a single lock acquisition, however
+  the sizes were interleaved.
+*/
+static inline void memorypa_own_free_window(unsigned char **blocks, unsigned char **pools, size_t count) {
+  unsigned char *block;
+  unsigned char *pool;
+  size_t i = 1;
+  size_t j;
+  while(i < count) {
+    block = blocks[i];
+    pool = pools[i];
+    j = i;
+    while(j && (size_t)pools[j - 1] > (size_t)pool) {
+      blocks[j] = blocks[j - 1];
+      pools[j] = pools[j - 1];
+      --j;
+    }
+    blocks[j] = block;
+    pools[j] = pool;
+    ++i;
+  }
+  i = 0;
+  while(i < count) {
+    j = i + 1;
+    while(j < count && pools[j] == pools[i]) {
+      ++j;
+    }
+    memorypa_pool_deallocate_batch(pools[i], blocks + i, j - i);
+    i = j;
+  }
+}
+
+/*
+  Data from the pools is freed a window at a time, see above. Everything
+  else is freed one by one as usual.
+*/
+static inline void memorypa_own_free_batch(unsigned char **data, size_t amount) {
+  unsigned char *blocks[MEMORYPA_BATCH_SIZE];
+  unsigned char *pools[MEMORYPA_BATCH_SIZE];
+  unsigned char *block;
+  unsigned char *pool;
+  size_t count = 0;
+  size_t i = 0;
+  while(i < amount) {
+    if(data[i] != NULL) {
+      block = memorypa_pool_block_get_block_from_data(data[i]);
+      pool = memorypa_pool_block_get_pool(block);
+      if(pool == NULL || pool == &memorypa_mapped_pool) {
+        memorypa_own_free(data[i]);
+      }
+      else {
+        if(count == MEMORYPA_BATCH_SIZE) {
+          memorypa_own_free_window(blocks, pools, count);
+          count = 0;
+        }
+        blocks[count] = block;
+        pools[count++] = pool;
+      }
+    }
+    ++i;
+  }
+  if(count) {
+    memorypa_own_free_window(blocks, pools, count);
+  }
+}
+
+/*
+  Moves data out of a block of "pool" when "new_size" belongs elsewhere.
+  Only the first "size" bytes of the data are worth copying.
+*/
+static inline unsigned char * memorypa_own_realloc_from_pool(unsigned char *data, unsigned char *block, unsigned char *pool, size_t size, size_t new_size) {
+  unsigned char *default_data = memorypa_pool_block_get_data(block);
+  size_t size_class = memorypa_own_route(new_size);
+  unsigned char *new_pool = memorypa_class_get_pool(size_class);
+  if(new_pool == NULL) {
+    unsigned char *new_data = memorypa_rescue_allocate_for_data(new_size);
+    if(new_data != NULL) {
+      memcpy(new_data, data, size < new_size ? size : new_size);
+      memorypa_thread_cache_deallocate_to_pool(pool, block);
+    }
+    if(!memorypa_mapping_serves(new_size)) {
+      memorypa_event_record(4, size_class, new_size);
+    }
+    return new_data;
+  }
+  if(pool == new_pool) {
+    if(default_data != data) {
+      memmove(default_data, data, size < new_size ? size : new_size);
+    }
+    return default_data;
+  }
+  unsigned char *new_data = memorypa_thread_cache_allocate(new_pool);
+  if(new_data == NULL) {
+    new_data = memorypa_rescue_allocate_for_data(new_size);
+    if(new_data != NULL) {
+      memcpy(new_data, data, size < new_size ? size : new_size);
+      memorypa_thread_cache_deallocate_to_pool(pool, block);
+    }
+    memorypa_event_record(5, size_class, new_size);
+  }
+  else {
+    new_data = memorypa_pool_block_get_data(new_data);
+    memcpy(new_data, data, size < new_size ? size : new_size);
+    memorypa_thread_cache_deallocate_to_pool(pool, block);
+  }
+  return new_data;
+}
+
+static inline unsigned char * memorypa_own_realloc(unsigned char *data, size_t new_size) {
+  // Yes, the spec allows this:
+  if(data == NULL) {
+    return memorypa_own_malloc(new_size);
+  }
+  //
+  unsigned char *block = memorypa_pool_block_get_block_from_data(data);
+  unsigned char *pool = memorypa_pool_block_get_pool(block);
+  unsigned char *default_data = memorypa_pool_block_get_data(block);
+  if(pool == NULL || pool == &memorypa_mapped_pool) {
+    if(pool == NULL) {
+      memorypa_event_record(3, 0, new_size);
+    }
+    return memorypa_rescue_reallocate_for_data(block, new_size, data - default_data);
+  }
+  return memorypa_own_realloc_from_pool(data, block, pool, memorypa_pool_get_block_size(pool) - (data - default_data), new_size);
+}
+
+/*
+  Given the size that was asked for, the pool is one route away, and
+  data inside its block list must be one of its blocks. Data handed out
+  by "malloc" always starts at the default offset, so the block is right
+  in front of it. None of this touches the block itself. Anything else
+  (rescued, mapped, or from a segment) returns null and goes the long
+  way. With "MEMORYPA_DEBUG", the header is checked against the size.
+*/
+static inline unsigned char * memorypa_own_sized_get_pool(unsigned char *data, size_t size) {
+  unsigned char *pool = memorypa_class_get_pool(memorypa_own_route(size));
+  #ifdef MEMORYPA_DEBUG
+  unsigned char *block = memorypa_pool_block_get_block_from_data(data);
+  unsigned char *block_pool = memorypa_pool_block_get_pool(block);
+  if(
+    memorypa_pool_block_get_data(block) != data
+    || (block_pool == &memorypa_mapped_pool && size > memorypa_mapping_get_size(block) - memorypa_mapping_header_size - memorypa_block_header_size)
+    || (block_pool != NULL && block_pool != &memorypa_mapped_pool && block_pool != pool)
+  ) {
+    memorypa_write_message("memorypa: The size given to a sized \"free\" or \"realloc\" doesn't match the allocation!\n", MEMORYPA_WRITE_OPTION_STDERR);
+    exit(EXIT_FAILURE);
+  }
+  #endif
+  if(pool != NULL) {
+    unsigned char *block_list = memorypa_pool_get_block_list(pool);
+    if(data >= block_list + memorypa_block_header_size && data < block_list + (memorypa_pool_get_block_stride(memorypa_pool_get_block_size(pool)) * memorypa_pool_get_block_amount(pool))) {
+      return pool;
+    }
+  }
+  return NULL;
+}
+
+static inline void memorypa_own_free_sized(unsigned char *data, size_t size) {
+  if(data != NULL) {
+    unsigned char *pool = memorypa_own_sized_get_pool(data, size);
+    if(pool != NULL) {
+      memorypa_thread_cache_deallocate_to_pool(pool, data - memorypa_block_header_size);
+    }
+    else {
+      memorypa_own_free(data);
+    }
+  }
+}
+
+static inline unsigned char * memorypa_own_realloc_sized(unsigned char *data, size_t size, size_t new_size) {
+  if(data == NULL) {
+    return memorypa_own_malloc(new_size);
+  }
+  unsigned char *pool = memorypa_own_sized_get_pool(data, size);
+  if(pool == NULL) {
+    return memorypa_own_realloc(data, new_size);
+  }
+  return memorypa_own_realloc_from_pool(data, data - memorypa_block_header_size, pool, size, new_size);
 }
 
 /*
-  We have an unsigned short (only two bytes on normal computers) for
-  storing the alignment offset. Because I'm scared of endianness, this
-  function intentionally shifts and stores each byte in explicit
-  order. This guarantees that the terminator short is always zero when
-  the offset is small.
+  An arena is a stack of chunks, each an ordinary allocation (of the
+  largest pool's block size by default):
+
+  unsigned char *previous_chunk
+  unsigned char *end
+  unsigned char data[]
+
+  The arena itself is its first chunk, which is never freed and carries
+  the state after the chunk's own header:
+
+  unsigned char *previous_chunk (always null)
+  unsigned char *end
+  unsigned char *current_chunk
+  unsigned char *position
+  unsigned char *spare_chunk
+  unsigned char *bottom_chunk
+  size_t chunk_size
+  unsigned char data[]
+
+  Allocating bumps the position, or pushes a new chunk when the current
+  one can't fit the size. A mark is just the position, so rewinding pops
+  chunks until the mark lies within the current one. Popped chunks aren't
+  freed but kept on the spare list, linked through their previous chunk,
+  and pushing takes the first spare whenever it's large enough. The
+  bottom chunk is the one pushed right over the arena, so resetting can
+  move the whole stack onto the spare list at once. Arenas aren't
+  synchronized.
 */
-static inline void memorypa_pool_block_set_data_offset(unsigned char *data, unsigned short offset) {
-  data -= memorypa_2uc;
-  *data = (unsigned char)(offset >> memorypa_u_char_bit_size);
-  data += memorypa_u_char_size;
-  *data = (unsigned char)offset;
+static inline unsigned char * memorypa_arena_chunk_get_previous(unsigned char *chunk) {
+  return *((unsigned char **)chunk);
 }
 
-static inline unsigned char * memorypa_pool_block_get_block_from_data(unsigned char *data) {
-  data -= memorypa_2uc;
-  unsigned short offset = *data;
-  offset <<= memorypa_u_char_bit_size;
-  data += memorypa_u_char_size;
-  offset += *data;
-  // "1uc" instead of "2uc" because of the current value of "data":
-  data -= memorypa_1ucp_1uc;
-  data -= offset;
-  return data;
+static inline unsigned char * memorypa_arena_chunk_get_end(unsigned char *chunk) {
+  return *((unsigned char **)(chunk + memorypa_u_char_p_size));
 }
 
-static inline void memorypa_profile_real_set_size(unsigned char *real, size_t size) {
-  *((size_t *)real) = size;
+static inline void memorypa_arena_chunk_set(unsigned char *chunk, unsigned char *previous_chunk, unsigned char *end) {
+  *((unsigned char **)chunk) = previous_chunk;
+  *((unsigned char **)(chunk + memorypa_u_char_p_size)) = end;
 }
 
-static inline size_t memorypa_profile_real_get_size(unsigned char *real) {
-  return *((size_t *)real);
+static inline unsigned char * memorypa_arena_get_current(unsigned char *arena) {
+  return *((unsigned char **)(arena + (memorypa_u_char_p_size << 1)));
 }
 
-static inline void memorypa_profile_real_set_terminator(unsigned char *real) {
-  real += memorypa_size_t_size;
-  *real = 0;
-  real += memorypa_u_char_size;
-  *real = 0;
+static inline void memorypa_arena_set_current(unsigned char *arena, unsigned char *chunk) {
+  *((unsigned char **)(arena + (memorypa_u_char_p_size << 1))) = chunk;
 }
 
-static inline unsigned short memorypa_profile_real_get_terminator(unsigned char *real) {
-  real += memorypa_size_t_size;
-  unsigned short output = *real;
-  output <<= memorypa_u_char_bit_size;
-  real += memorypa_u_char_size;
-  output += *real;
-  return output;
+static inline unsigned char * memorypa_arena_get_position(unsigned char *arena) {
+  return *((unsigned char **)(arena + (memorypa_u_char_p_size * 3)));
 }
 
-static inline unsigned char * memorypa_profile_real_get_data(unsigned char *real) {
-  return real + memorypa_1st_2uc;
+static inline void memorypa_arena_set_position(unsigned char *arena, unsigned char *position) {
+  *((unsigned char **)(arena + (memorypa_u_char_p_size * 3))) = position;
 }
 
-static inline unsigned char * memorypa_profile_get_real_from_data(unsigned char *data) {
-  data -= memorypa_2uc;
-  unsigned short offset = *data;
-  offset <<= memorypa_u_char_bit_size;
-  data += memorypa_u_char_size;
-  offset += *data;
-  // "1uc" instead of "2uc" because of the current value of "data":
-  data -= memorypa_1st_1uc;
-  data -= offset;
-  return data;
+static inline unsigned char * memorypa_arena_get_spare(unsigned char *arena) {
+  return *((unsigned char **)(arena + (memorypa_u_char_p_size << 2)));
 }
 
-static inline unsigned char * memorypa_profile_allocate(size_t size) {
-  unsigned char *data = memorypa_given_malloc(memorypa_1st_2uc + size);
-  if(data != NULL) {
-    size_t power = memorypa_own_msb(size);
-    unsigned char *pool = memorypa_pool_list[power - 1];
-    if(pool != NULL) {
-      power = memorypa_adjust_msb(size, power, memorypa_pool_get_block_padding(pool));
+static inline void memorypa_arena_set_spare(unsigned char *arena, unsigned char *chunk) {
+  *((unsigned char **)(arena + (memorypa_u_char_p_size << 2))) = chunk;
+}
+
+static inline unsigned char * memorypa_arena_get_bottom(unsigned char *arena) {
+  return *((unsigned char **)(arena + (memorypa_u_char_p_size * 5)));
+}
+
+static inline void memorypa_arena_set_bottom(unsigned char *arena, unsigned char *chunk) {
+  *((unsigned char **)(arena + (memorypa_u_char_p_size * 5))) = chunk;
+}
+
+static inline size_t memorypa_arena_get_chunk_size(unsigned char *arena) {
+  return *((size_t *)(arena + (memorypa_u_char_p_size * 6)));
+}
+
+// Where data begins in the given chunk:
+static inline unsigned char * memorypa_arena_chunk_get_data(unsigned char *arena, unsigned char *chunk) {
+  return chunk + (chunk == arena ? memorypa_arena_header_size : memorypa_arena_chunk_header_size);
+}
+
+static inline unsigned char * memorypa_own_arena_create(size_t chunk_size) {
+  if(!chunk_size) {
+    chunk_size = MEMORYPA_ARENA_CHUNK_SIZE;
+    size_t i = memorypa_class_count;
+    while(i--) {
+      unsigned char *pool = memorypa_class_get_pool(i);
+      if(pool != NULL) {
+        chunk_size = memorypa_pool_get_block_size(pool);
+        break;
+      }
     }
-    memorypa_profile_real_set_size(data, size);
-    memorypa_profile_real_set_terminator(data);
-    memorypa_lock(&memorypa_profile_lock);
-    memorypa_profile_increment(power);
-    memorypa_unlock(&memorypa_profile_lock);
-    data = memorypa_profile_real_get_data(data);
   }
-  return data;
+  if(chunk_size < memorypa_arena_header_size) {
+    chunk_size = memorypa_arena_header_size;
+  }
+  unsigned char *arena = memorypa_own_malloc(chunk_size);
+  if(arena != NULL) {
+    memorypa_arena_chunk_set(arena, NULL, arena + chunk_size);
+    memorypa_arena_set_current(arena, arena);
+    memorypa_arena_set_position(arena, arena + memorypa_arena_header_size);
+    memorypa_arena_set_spare(arena, NULL);
+    memorypa_arena_set_bottom(arena, NULL);
+    *((size_t *)(arena + (memorypa_u_char_p_size * 6))) = chunk_size;
+  }
+  return arena;
 }
 
-static inline void memorypa_profile_deallocate_real(unsigned char *real) {
-  memorypa_lock(&memorypa_profile_lock);
-  size_t size = memorypa_profile_real_get_size(real);
-  size_t power = memorypa_own_msb(size);
-  unsigned char *pool = memorypa_pool_list[power - 1];
-  if(pool != NULL) {
-    power = memorypa_adjust_msb(size, power, memorypa_pool_get_block_padding(pool));
+static inline unsigned char * memorypa_own_arena_aligned_malloc(unsigned char *arena, size_t size, size_t alignment) {
+  if(alignment < memorypa_block_alignment) {
+    alignment = memorypa_block_alignment;
   }
-  memorypa_profile_decrement(power);
-  memorypa_unlock(&memorypa_profile_lock);
-  memorypa_given_free(real);
+  unsigned char *position = memorypa_arena_get_position(arena);
+  unsigned char *end = memorypa_arena_chunk_get_end(memorypa_arena_get_current(arena));
+  unsigned char *data = position + ((alignment - ((size_t)position & (alignment - 1))) & (alignment - 1));
+  if(data > end || size > (size_t)(end - data)) {
+    size_t chunk_size = memorypa_arena_get_chunk_size(arena);
+    size_t needed_size = memorypa_arena_chunk_header_size + alignment - 1;
+    if(size > ((size_t)-1) - needed_size) {
+      return NULL;
+    }
+    needed_size += size;
+    if(needed_size > chunk_size) {
+      chunk_size = needed_size;
+    }
+    unsigned char *chunk = memorypa_arena_get_spare(arena);
+    if(chunk != NULL && (size_t)(memorypa_arena_chunk_get_end(chunk) - chunk) >= needed_size) {
+      memorypa_arena_set_spare(arena, memorypa_arena_chunk_get_previous(chunk));
+      memorypa_arena_chunk_set(chunk, memorypa_arena_get_current(arena), memorypa_arena_chunk_get_end(chunk));
+    }
+    else {
+      chunk = memorypa_own_malloc(chunk_size);
+      if(chunk == NULL) {
+        return NULL;
+      }
+      memorypa_arena_chunk_set(chunk, memorypa_arena_get_current(arena), chunk + chunk_size);
+    }
+    if(memorypa_arena_get_current(arena) == arena) {
+      memorypa_arena_set_bottom(arena, chunk);
+    }
+    memorypa_arena_set_current(arena, chunk);
+    position = chunk + memorypa_arena_chunk_header_size;
+    data = position + ((alignment - ((size_t)position & (alignment - 1))) & (alignment - 1));
+  }
+  memorypa_arena_set_position(arena, data + size);
+  return data;
 }
 
-static inline unsigned char memorypa_pool_block_is_invalid(unsigned char *block, unsigned char *assigned_pool) {
-  if(memorypa_pool_block_get_pool(block) != assigned_pool) {
-    memorypa_write_message("memorypa: Block ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_hex((size_t)block, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" of pool ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_hex((size_t)assigned_pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" has the incorrect pool!\n", MEMORYPA_WRITE_OPTION_STDERR);
-    return 1;
+/*
+  Pops every chunk the mark doesn't lie in onto the spare list. The work
+  only grows with the chunks popped, never with what was allocated from
+  them. A mark found in no chunk rewinds the whole arena.
+*/
+static inline void memorypa_own_arena_rewind(unsigned char *arena, unsigned char *mark) {
+  unsigned char *chunk = memorypa_arena_get_current(arena);
+  unsigned char *previous_chunk;
+  while(chunk != arena && (mark < chunk + memorypa_arena_chunk_header_size || mark > memorypa_arena_chunk_get_end(chunk))) {
+    previous_chunk = memorypa_arena_chunk_get_previous(chunk);
+    memorypa_arena_chunk_set(chunk, memorypa_arena_get_spare(arena), memorypa_arena_chunk_get_end(chunk));
+    memorypa_arena_set_spare(arena, chunk);
+    chunk = previous_chunk;
   }
-  if(memorypa_pool_block_get_terminator(block)) {
-    memorypa_write_message("memorypa: Block ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_hex((size_t)block, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" of pool ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_hex((size_t)assigned_pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" has an invalid terminator!\n", MEMORYPA_WRITE_OPTION_STDERR);
-    return 2;
+  if(mark < memorypa_arena_chunk_get_data(arena, chunk) || mark > memorypa_arena_chunk_get_end(chunk)) {
+    mark = memorypa_arena_chunk_get_data(arena, chunk);
   }
-  return 0;
+  memorypa_arena_set_current(arena, chunk);
+  memorypa_arena_set_position(arena, mark);
 }
 
-static inline unsigned char memorypa_pool_free_block_is_invalid(unsigned char *free_block, unsigned char *assigned_pool, size_t *free_blocks) {
-  unsigned char *block = memorypa_pool_free_block_get_block(free_block);
-  if(block != NULL) {
-    ++(*free_blocks);
-    return memorypa_pool_block_is_invalid(block, assigned_pool);
+// Moves the whole stack onto the spare list, however many chunks it has:
+static inline void memorypa_own_arena_reset(unsigned char *arena) {
+  unsigned char *chunk = memorypa_arena_get_current(arena);
+  if(chunk != arena) {
+    unsigned char *bottom_chunk = memorypa_arena_get_bottom(arena);
+    memorypa_arena_chunk_set(bottom_chunk, memorypa_arena_get_spare(arena), memorypa_arena_chunk_get_end(bottom_chunk));
+    memorypa_arena_set_spare(arena, chunk);
+    memorypa_arena_set_current(arena, arena);
   }
-  return 0;
+  memorypa_arena_set_position(arena, arena + memorypa_arena_header_size);
 }
 
-static inline unsigned char memorypa_pool_is_invalid(unsigned char *pool, size_t *output_size) {
-  if(memorypa_pool_lock_load(pool) > 1) {
-    memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" has invalid lock value!\n", MEMORYPA_WRITE_OPTION_STDERR);
-    return 1;
-  }
-  memorypa_pool_lock(pool);
-  size_t block_size = memorypa_pool_get_block_size(pool);
-  size_t block_padding = memorypa_pool_get_block_padding(pool);
-  size_t power_of_two = block_size - block_padding + 1;
-  if(power_of_two & (power_of_two - 1)) {
-    memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" has invalid block size (", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(block_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(") and padding (", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(block_padding, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(")!\n", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_pool_unlock(pool);
-    return 2;
-  }
-  size_t block_amount = memorypa_pool_get_block_amount(pool);
-  *output_size = memorypa_pool_get_total_size(block_size, block_amount);
-  size_t free_blocks = memorypa_pool_get_free_blocks(pool);
-  size_t counted_free_blocks = 0;
-  unsigned char *current_list = memorypa_pool_get_free_block_list(pool);
-  size_t i = 0;
-  while(i < block_amount) {
-    if(memorypa_pool_free_block_is_invalid(memorypa_pool_free_block_list_at(current_list, i), pool, &counted_free_blocks)) {
-      memorypa_pool_unlock(pool);
-      return 3;
+// The chunks only go back to the pools here, in batches of "MEMORYPA_BATCH_SIZE":
+static inline void memorypa_own_arena_destroy(unsigned char *arena) {
+  unsigned char *chunks[MEMORYPA_BATCH_SIZE];
+  size_t count = 0;
+  memorypa_own_arena_reset(arena);
+  unsigned char *chunk = memorypa_arena_get_spare(arena);
+  while(chunk != NULL) {
+    if(count == MEMORYPA_BATCH_SIZE) {
+      memorypa_own_free_batch(chunks, count);
+      count = 0;
     }
-    ++i;
-  }
-  if(counted_free_blocks != free_blocks) {
-    memorypa_write_message("memorypa: Pool ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_hex((size_t)pool, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" has invalid free block amount!\n", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_pool_unlock(pool);
-    return 4;
+    chunks[count++] = chunk;
+    chunk = memorypa_arena_chunk_get_previous(chunk);
   }
-  current_list = memorypa_pool_get_block_list(pool);
-  i = 0;
-  while(i < block_amount) {
-    if(memorypa_pool_block_is_invalid(memorypa_pool_block_list_at(current_list, block_size, i), pool)) {
-      memorypa_pool_unlock(pool);
-      return 5;
-    }
-    ++i;
+  if(count) {
+    memorypa_own_free_batch(chunks, count);
   }
-  memorypa_pool_unlock(pool);
-  return 0;
+  memorypa_own_free(arena);
 }
 
-static inline void memorypa_pool_initialize(unsigned char *pool, size_t block_size, size_t block_padding, size_t block_amount) {
-  memorypa_pool_set_lock(pool);
-  memorypa_pool_set_block_size(pool, block_size);
-  memorypa_pool_set_block_padding(pool, block_padding);
-  memorypa_pool_set_block_amount(pool, block_amount);
-  memorypa_pool_set_free_blocks(pool, block_amount);
-  memorypa_pool_set_block_list(pool, block_amount);
-  unsigned char *block_list = memorypa_pool_get_block_list(pool);
-  unsigned char *free_block_list = memorypa_pool_get_free_block_list(pool);
-  unsigned char *current_block;
-  size_t i = 0;
-  while(i < block_amount) {
-    current_block = memorypa_pool_block_list_at(block_list, block_size, i);
-    memorypa_pool_block_set_pool(current_block, pool);
-    memorypa_pool_block_set_terminator(current_block);
-    memorypa_pool_free_block_set_block(
-      memorypa_pool_free_block_list_at(free_block_list, i),
-      current_block
-    );
-    ++i;
+/*
+  A heap is a set of pools of its own, apart from the global ones, laid
+  out in a single allocation from the given "malloc":
+
+  size_t class_count
+  size_t options_count
+  unsigned char *given
+  unsigned char *pools
+  memorypa_pool_options options[options_count]
+  size_t limit, unsigned char *pool (for each class)
+  [cache line]
+  pools
+
+  The options are kept so that a reset can start the pools over. Heaps
+  share everything else (the given functions, block headers, rescues
+  and mappings) with the global pools, but never their thread caches or
+  per-CPU slices. Blocks from a heap's pools may also be freed with
+  "memorypa_free" as long as there are block headers.
+*/
+static inline size_t memorypa_heap_get_class_count(unsigned char *heap) {
+  return *((size_t *)heap);
+}
+
+static inline size_t memorypa_heap_get_options_count(unsigned char *heap) {
+  return *((size_t *)(heap + memorypa_size_t_size));
+}
+
+static inline unsigned char * memorypa_heap_get_given(unsigned char *heap) {
+  return *((unsigned char **)(heap + memorypa_2st));
+}
+
+static inline unsigned char * memorypa_heap_get_pools(unsigned char *heap) {
+  return *((unsigned char **)(heap + memorypa_2st + memorypa_u_char_p_size));
+}
+
+static inline memorypa_pool_options * memorypa_heap_get_options(unsigned char *heap) {
+  return (memorypa_pool_options *)(heap + memorypa_2st + (memorypa_u_char_p_size << 1));
+}
+
+static inline unsigned char * memorypa_heap_get_class_list(unsigned char *heap) {
+  return heap + memorypa_2st + (memorypa_u_char_p_size << 1) + (memorypa_heap_get_options_count(heap) * sizeof(memorypa_pool_options));
+}
+
+static inline size_t memorypa_heap_class_get_limit(unsigned char *heap, size_t size_class) {
+  return *((size_t *)(memorypa_heap_get_class_list(heap) + (size_class * memorypa_1st_1ucp)));
+}
+
+static inline unsigned char * memorypa_heap_class_get_pool(unsigned char *heap, size_t size_class) {
+  return *((unsigned char **)(memorypa_heap_get_class_list(heap) + (size_class * memorypa_1st_1ucp) + memorypa_size_t_size));
+}
+
+static inline unsigned char * memorypa_heap_get_end(unsigned char *heap) {
+  memorypa_pool_options *options = memorypa_heap_get_options(heap);
+  unsigned char *end = memorypa_heap_get_pools(heap);
+  size_t i = memorypa_heap_get_options_count(heap);
+  while(i--) {
+    end += options[i].own_size;
   }
+  return end;
 }
 
-static inline void memorypa_pools_initialize(memorypa_pool_options *sets_of_options) {
-  // Include the profile list's size:
-  memorypa_everything_size = memorypa_profile_list_size;
-  // Include the pool list's size:
-  memorypa_everything_size += memorypa_pool_list_size;
-  /*
-    Calculate the total size then allocate. Note that the whole strategy
-    of this library is to divide memory allocation purely along powers of
-    2, and to satisfy the requested size using its most significant
-    bit. E.g. if someone requests 124 bytes, its MSB ("memorypa_own_msb"
-    above) is 7 so a block from "memorypa_pool_list[7]" will be quickly
-    returned automatically. Note that it's impossible for a number greater
-    than 127 to have an MSB of 7, so the block size of the pool at
-    "memorypa_pool_list[7]" is 127, not 128 as one might expect.
-  */
-  size_t i = 0;
+// The same walk as for the global pools, minus the caches:
+static inline void memorypa_heap_pools_initialize(unsigned char *heap) {
+  memorypa_pool_options *options = memorypa_heap_get_options(heap);
+  size_t options_count = memorypa_heap_get_options_count(heap);
+  unsigned char *class_list = memorypa_heap_get_class_list(heap);
+  unsigned char *pools = memorypa_heap_get_pools(heap);
+  unsigned char *pool;
+  size_t limit;
+  size_t class_count = 0;
+  size_t i = 1;
   size_t j = 0;
-  size_t sets_of_options_size = 0;
-  while(i < memorypa_size_t_bit_size) {
-    j = i + 1;
-    if(sets_of_options[i].power) {
-      ++sets_of_options_size;
-      sets_of_options[i].own_block_size = (memorypa_one << sets_of_options[i].power) - 1 + sets_of_options[i].padding;
-      sets_of_options[i].own_size = memorypa_pool_get_total_size(sets_of_options[i].own_block_size, sets_of_options[i].amount);
-      sets_of_options[i].own_relative_position = memorypa_everything_size;
-      memorypa_everything_size += sets_of_options[i].own_size;
-      if(j < memorypa_size_t_bit_size && sets_of_options[j].power && sets_of_options[i].power >= sets_of_options[j].power) {
-        memorypa_write_message("memorypa: Invalid options! Specified powers must be unique and in ascending order!\n", MEMORYPA_WRITE_OPTION_STDERR);
-        exit(EXIT_FAILURE);
+  size_t k;
+  while(i <= memorypa_size_t_bit_size) {
+    if(j < options_count && options[j].power == i) {
+      pool = pools + options[j].own_relative_position;
+      k = 1;
+      do {
+        limit = memorypa_pool_options_get_class_limit(options + j, k);
+        *((size_t *)(class_list + (class_count * memorypa_1st_1ucp))) = limit;
+        *((unsigned char **)(class_list + (class_count * memorypa_1st_1ucp) + memorypa_size_t_size)) = pool;
+        memorypa_pool_initialize(pool, options + j, limit, 0, class_count);
+        pool += memorypa_pool_get_total_size(limit, options[j].amount, options[j].free_list);
+        ++class_count;
       }
+      while(++k <= options[j].steps);
+      ++j;
     }
     else {
-      break;
-    }
-    i = j;
-  }
-  memorypa_everything = memorypa_given_malloc(memorypa_everything_size);
-  if(memorypa_everything == NULL) {
-    memorypa_write_message("memorypa: Cannot initialize any pools because the given \"malloc\" returned null!\n", MEMORYPA_WRITE_OPTION_STDERR);
-    exit(EXIT_FAILURE);
-  }
-  memset(memorypa_everything, 0, memorypa_everything_size);
-  // Merely set the profile list (it's already zeroed out):
-  memorypa_profile_list = memorypa_everything;
-  // Prepare the pool list:
-  memorypa_pool_list = (unsigned char **)(memorypa_everything + memorypa_profile_list_size);
-  /*
-    Each index in "memory_pool_list" represents the power of 2 of the
-    block size of its pool, as shown above. If the user does not provide a
-    pool for a given power, then the next highest available power is
-    used. If the user did not provide a pool with higher power for a given
-    index, then it's left as null. This pattern allows the user to
-    minimize the number of pool options and allocate only as many pools as
-    needed.
-  */
-  i = 0;
-  j = 0;
-  while(i < memorypa_size_t_bit_size) {
-    if(j < sets_of_options_size) {
-      if(i > sets_of_options[j].power) {
-        while(++j < sets_of_options_size) {
-          if(i <= sets_of_options[j].power) {
-            memorypa_pool_list[i] = memorypa_everything + sets_of_options[j].own_relative_position;
-            break;
-          }
-        }
-      }
-      else {
-        memorypa_pool_list[i] = memorypa_everything + sets_of_options[j].own_relative_position;
+      limit = i < memorypa_size_t_bit_size ? (memorypa_one << i) - 1 : ~(size_t)0;
+      if(!class_count || limit > *((size_t *)(class_list + ((class_count - 1) * memorypa_1st_1ucp)))) {
+        *((size_t *)(class_list + (class_count * memorypa_1st_1ucp))) = limit;
+        *((unsigned char **)(class_list + (class_count * memorypa_1st_1ucp) + memorypa_size_t_size)) = j < options_count ? pools + options[j].own_relative_position : NULL;
+        ++class_count;
       }
     }
-    else {
-      memorypa_pool_list[i] = NULL;
-    }
-    ++i;
-  }
-  // Initialize each pool:
-  i = 0;
-  while(i < sets_of_options_size) {
-    memorypa_pool_initialize(memorypa_everything + sets_of_options[i].own_relative_position, sets_of_options[i].own_block_size, sets_of_options[i].padding, sets_of_options[i].amount);
     ++i;
   }
+  *((size_t *)heap) = class_count;
 }
 
-static inline unsigned char * memorypa_pool_allocate(unsigned char *pool) {
-  unsigned char *output = NULL;
-  memorypa_pool_lock(pool);
-  size_t free_blocks = memorypa_pool_get_free_blocks(pool);
-  if(free_blocks) {
-    memorypa_pool_set_free_blocks(pool, --free_blocks);
-    unsigned char *free_block = memorypa_pool_get_free_block_list(pool);
-    free_block = memorypa_pool_free_block_list_at(free_block, free_blocks);
-    output = memorypa_pool_free_block_get_block(free_block);
-    memorypa_pool_free_block_set_block(free_block, NULL);
-  }
-  memorypa_pool_unlock(pool);
-  return output;
-}
-
-static inline unsigned char * memorypa_rescue_allocate_for_data(size_t size) {
-  unsigned char *output = memorypa_given_malloc(memorypa_1ucp_2uc + size);
-  if(output != NULL) {
-    memorypa_pool_block_set_pool(output, NULL);
-    memorypa_pool_block_set_terminator(output);
-    output = memorypa_pool_block_get_data(output);
-  }
-  return output;
-}
-
-static inline unsigned char * memorypa_rescue_reallocate_for_default_data(unsigned char *block, size_t new_size) {
-  unsigned char *output = memorypa_given_realloc(block, memorypa_1ucp_2uc + new_size);
-  if(output != NULL) {
-    output = memorypa_pool_block_get_data(output);
+/*
+  Heaps validate a copy of the given options, since validation fills in
+  defaults and sizes. Invalid options are reported, and no heap is made.
+*/
+static inline unsigned char * memorypa_own_heap_create(memorypa_pool_options *given_options) {
+  memorypa_pool_options sets_of_options[sizeof(size_t) * CHAR_BIT];
+  memset(sets_of_options, 0, sizeof(sets_of_options));
+  size_t i = 0;
+  while(i < memorypa_size_t_bit_size && given_options[i].power) {
+    if(given_options[i].cache || given_options[i].per_cpu) {
+      memorypa_write_message("memorypa: Invalid options! Heaps can't have thread caches or per-CPU pools!\n", MEMORYPA_WRITE_OPTION_STDERR);
+      return NULL;
+    }
+    sets_of_options[i] = given_options[i];
+    ++i;
   }
-  return output;
-}
-
-static inline unsigned char * memorypa_rescue_reallocate_for_data(unsigned char *block, size_t new_size, size_t offset) {
-  unsigned char *output = memorypa_given_realloc(block, memorypa_1ucp_2uc + new_size + offset);
-  if(output != NULL) {
-    output = memorypa_pool_block_get_data(output) + offset;
+  size_t options_count, class_bound;
+  const char *invalid = memorypa_pools_validate(sets_of_options, &options_count, &class_bound);
+  if(invalid != NULL) {
+    memorypa_write_message(invalid, MEMORYPA_WRITE_OPTION_STDERR);
+    return NULL;
   }
-  return output;
-}
-
-static inline void memorypa_pool_deallocate(unsigned char *block) {
-  unsigned char *pool = memorypa_pool_block_get_pool(block);
-  if(pool == NULL) {
-    memorypa_given_free(block);
+  size_t pools_offset = memorypa_round_up_to_cache_line(memorypa_2st + (memorypa_u_char_p_size << 1) + (options_count * sizeof(memorypa_pool_options)) + (class_bound * memorypa_1st_1ucp));
+  size_t size = pools_offset;
+  size_t k;
+  i = 0;
+  while(i < options_count) {
+    sets_of_options[i].own_size = 0;
+    k = 1;
+    do {
+      sets_of_options[i].own_size += memorypa_pool_get_total_size(memorypa_pool_options_get_class_limit(sets_of_options + i, k), sets_of_options[i].amount, sets_of_options[i].free_list);
+    }
+    while(++k <= sets_of_options[i].steps);
+    sets_of_options[i].own_relative_position = size - pools_offset;
+    size += sets_of_options[i].own_size;
+    ++i;
   }
-  else {
-    memorypa_pool_lock(pool);
-    size_t free_blocks = memorypa_pool_get_free_blocks(pool);
-    unsigned char *free_block = memorypa_pool_get_free_block_list(pool);
-    free_block = memorypa_pool_free_block_list_at(free_block, free_blocks);
-    memorypa_pool_free_block_set_block(free_block, block);
-    memorypa_pool_set_free_blocks(pool, ++free_blocks);
-    memorypa_pool_unlock(pool);
+  unsigned char *given = memorypa_given_malloc(size + MEMORYPA_CACHE_LINE_SIZE - 1);
+  if(given == NULL) {
+    return NULL;
   }
+  unsigned char *heap = (unsigned char *)memorypa_round_up_to_cache_line((size_t)given);
+  memset(heap, 0, pools_offset);
+  *((size_t *)(heap + memorypa_size_t_size)) = options_count;
+  *((unsigned char **)(heap + memorypa_2st)) = given;
+  *((unsigned char **)(heap + memorypa_2st + memorypa_u_char_p_size)) = heap + pools_offset;
+  memcpy(memorypa_heap_get_options(heap), sets_of_options, options_count * sizeof(memorypa_pool_options));
+  memorypa_heap_pools_initialize(heap);
+  return heap;
 }
 
-static inline unsigned char * memorypa_own_malloc(size_t size) {
-  unsigned char *output = NULL;
-  size_t power = memorypa_own_msb(size);
-  unsigned char *pool = memorypa_pool_list[power - 1];
-  if(pool != NULL) {
-    power = memorypa_adjust_msb(size, power, memorypa_pool_get_block_padding(pool));
-  }
-  pool = memorypa_pool_list[power];
-  if(pool != NULL) {
-    if((output = memorypa_pool_allocate(pool)) != NULL) {
-      output = memorypa_pool_block_get_data(output);
+static inline size_t memorypa_heap_route(unsigned char *heap, size_t size) {
+  size_t low = 0;
+  size_t high = memorypa_heap_get_class_count(heap) - 1;
+  size_t middle;
+  while(low < high) {
+    middle = (low + high) >> 1;
+    if(memorypa_heap_class_get_limit(heap, middle) < size) {
+      low = middle + 1;
     }
     else {
-      output = memorypa_rescue_allocate_for_data(size);
-      memorypa_write_message("memorypa: Pool #", MEMORYPA_WRITE_OPTION_STDERR);
-      memorypa_write_decimal(power, 0, MEMORYPA_WRITE_OPTION_STDERR);
-      memorypa_write_message(" is out of memory for size ", MEMORYPA_WRITE_OPTION_STDERR);
-      memorypa_write_decimal(size, 0, MEMORYPA_WRITE_OPTION_STDERR);
-      memorypa_write_message("! (1)\n", MEMORYPA_WRITE_OPTION_STDERR);
+      high = middle;
     }
   }
-  else {
-    output = memorypa_rescue_allocate_for_data(size);
-    memorypa_write_message("memorypa: Pool #", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(power, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" has not been initialized for size ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(size, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message("! (2)\n", MEMORYPA_WRITE_OPTION_STDERR);
-  }
-  return output;
+  return low;
 }
 
-static inline unsigned char * memorypa_own_aligned_malloc(size_t size, unsigned short alignment) {
-  unsigned char *data = memorypa_own_malloc(size + alignment - 1);
-  if(data != NULL) {
-    size_t offset = (size_t)data & (alignment - 1);
-    if(offset) {
-      offset = alignment - offset;
-      data += offset;
-      memorypa_pool_block_set_data_offset(data, (unsigned short)offset);
+/*
+  Finds the pool of the heap holding the given data, or null when it lies
+  outside them. Header-less blocks have nothing else to go by.
+*/
+static inline unsigned char * memorypa_heap_find(unsigned char *heap, unsigned char *data) {
+  if(data < memorypa_heap_get_pools(heap) || data >= memorypa_heap_get_end(heap)) {
+    return NULL;
+  }
+  unsigned char *pool;
+  size_t low = 0;
+  size_t high = memorypa_heap_get_class_count(heap);
+  size_t middle;
+  while(high - low > 1) {
+    middle = (low + high) >> 1;
+    pool = memorypa_heap_class_get_pool(heap, middle);
+    if(pool != NULL && pool <= data) {
+      low = middle;
+    }
+    else {
+      high = middle;
     }
   }
-  return data;
+  return memorypa_heap_class_get_pool(heap, low);
 }
 
-static inline unsigned char * memorypa_own_calloc(size_t amount, size_t unit_size) {
-  size_t size = amount * unit_size;
-  unsigned char *data = memorypa_own_malloc(size);
-  if(data != NULL) {
-    memset(data, 0, size);
-  }
-  return data;
+static inline unsigned char * memorypa_heap_get_pool_from_data(unsigned char *heap, unsigned char *data) {
+  return memorypa_headerless ? memorypa_heap_find(heap, data) : memorypa_pool_block_get_pool(memorypa_pool_block_get_block_from_data(data));
 }
 
-static inline unsigned char * memorypa_own_aligned_calloc(size_t amount, size_t unit_size, unsigned short alignment) {
-  size_t size = amount * unit_size;
-  unsigned char *data = memorypa_own_aligned_malloc(size, alignment);
-  if(data != NULL) {
-    memset(data, 0, size);
-  }
-  return data;
+static inline unsigned char * memorypa_heap_allocate_from_pool(unsigned char *pool, size_t size) {
+  unsigned char *block = pool == NULL ? NULL : memorypa_pool_allocate(pool);
+  return block == NULL ? memorypa_rescue_allocate_for_data(size) : memorypa_pool_block_get_data(block);
 }
 
-static inline void memorypa_own_free(unsigned char *data) {
-  // The spec allows "NULL" to be passed without failure:
-  if(data != NULL) {
-    memorypa_pool_deallocate(memorypa_pool_block_get_block_from_data(data));
+static inline unsigned char * memorypa_own_heap_malloc(unsigned char *heap, size_t size) {
+  return memorypa_heap_allocate_from_pool(memorypa_heap_class_get_pool(heap, memorypa_heap_route(heap, size)), size);
+}
+
+static inline void memorypa_own_heap_free(unsigned char *heap, unsigned char *data) {
+  if(data == NULL) {
+    return;
   }
+  unsigned char *pool = memorypa_heap_get_pool_from_data(heap, data);
+  if(pool == NULL || pool == &memorypa_mapped_pool) {
+    memorypa_own_free(data);
+    return;
+  }
+  memorypa_pool_deallocate_to_pool(pool, memorypa_headerless ? data : memorypa_pool_block_get_block_from_data(data));
 }
 
-static inline unsigned char * memorypa_own_realloc(unsigned char *data, size_t new_size) {
-  // Yes, the spec allows this:
+static inline unsigned char * memorypa_own_heap_realloc(unsigned char *heap, unsigned char *data, size_t new_size) {
   if(data == NULL) {
-    return memorypa_own_malloc(new_size);
+    return memorypa_own_heap_malloc(heap, new_size);
   }
-  //
-  unsigned char *block = memorypa_pool_block_get_block_from_data(data);
-  unsigned char *pool = memorypa_pool_block_get_pool(block);
+  unsigned char *pool = memorypa_heap_get_pool_from_data(heap, data);
+  unsigned char *block = memorypa_headerless && pool != NULL ? data : memorypa_pool_block_get_block_from_data(data);
   unsigned char *default_data = memorypa_pool_block_get_data(block);
-  if(pool == NULL) {
-    memorypa_write_message("memorypa: This is a rescued allocation! Using the given \"realloc\". (3)\n", MEMORYPA_WRITE_OPTION_STDERR);
+  if(pool == NULL || pool == &memorypa_mapped_pool) {
     return memorypa_rescue_reallocate_for_data(block, new_size, data - default_data);
   }
-  size_t power = memorypa_own_msb(new_size);
-  unsigned char *new_pool = memorypa_pool_list[power - 1];
-  if(new_pool != NULL) {
-    power = memorypa_adjust_msb(new_size, power, memorypa_pool_get_block_padding(new_pool));
-  }
-  new_pool = memorypa_pool_list[power];
-  if(new_pool == NULL) {
-    unsigned char *new_data = memorypa_rescue_allocate_for_data(new_size);
-    if(new_data != NULL) {
-      size_t offset_size = memorypa_pool_get_block_size(pool) - (data - default_data);
-      memcpy(new_data, data, offset_size < new_size ? offset_size : new_size);
-      memorypa_pool_deallocate(block);
-    }
-    memorypa_write_message("memorypa: Pool #", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(power, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" has not been initialized for size ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(new_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message("! (4)\n", MEMORYPA_WRITE_OPTION_STDERR);
-    return new_data;
-  }
+  unsigned char *new_pool = memorypa_heap_class_get_pool(heap, memorypa_heap_route(heap, new_size));
+  size_t size = memorypa_pool_get_block_size(pool) - (data - default_data);
   if(pool == new_pool) {
     if(default_data != data) {
-      size_t offset_size = memorypa_pool_get_block_size(pool) - (data - default_data);
-      memmove(default_data, data, offset_size < new_size ? offset_size : new_size);
+      memmove(default_data, data, size < new_size ? size : new_size);
     }
     return default_data;
   }
-  unsigned char *new_data = memorypa_pool_allocate(new_pool);
-  if(new_data == NULL) {
-    new_data = memorypa_rescue_allocate_for_data(new_size);
-    if(new_data != NULL) {
-      size_t offset_size = memorypa_pool_get_block_size(pool) - (data - default_data);
-      memcpy(new_data, data, offset_size < new_size ? offset_size : new_size);
-      memorypa_pool_deallocate(block);
-    }
-    memorypa_write_message("memorypa: Pool #", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(power, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" is out of memory for size ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(new_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message("! (5)\n", MEMORYPA_WRITE_OPTION_STDERR);
-  }
-  else {
-    new_data = memorypa_pool_block_get_data(new_data);
-    size_t offset_size = memorypa_pool_get_block_size(pool) - (data - default_data);
-    memcpy(new_data, data, offset_size < new_size ? offset_size : new_size);
-    memorypa_pool_deallocate(block);
+  unsigned char *new_data = memorypa_heap_allocate_from_pool(new_pool, new_size);
+  if(new_data != NULL) {
+    memcpy(new_data, data, size < new_size ? size : new_size);
+    memorypa_pool_deallocate_to_pool(pool, block);
   }
   return new_data;
 }
 
+// Gives the segments back, and lets "reset" start the pools over:
+static inline void memorypa_heap_release_segments(unsigned char *heap) {
+  unsigned char *previous = NULL;
+  unsigned char *pool;
+  size_t i = 0;
+  size_t class_count = memorypa_heap_get_class_count(heap);
+  do {
+    pool = memorypa_heap_class_get_pool(heap, i);
+    if(pool != NULL && pool != previous) {
+      previous = pool;
+      memorypa_pool_release_segments(pool);
+    }
+  }
+  while(++i < class_count);
+}
+
 static inline unsigned char * memorypa_own_aligned_realloc(unsigned char *data, size_t new_size, unsigned short alignment) {
+  if(alignment <= memorypa_block_alignment) {
+    return memorypa_own_realloc(data, new_size);
+  }
   // Yes, the spec allows this:
   if(data == NULL) {
     return memorypa_own_aligned_malloc(new_size, alignment);
@@ -768,12 +3680,15 @@ static inline unsigned char * memorypa_own_aligned_realloc(unsigned char *data,
   unsigned char *block = memorypa_pool_block_get_block_from_data(data);
   unsigned char *pool = memorypa_pool_block_get_pool(block);
   unsigned char *default_data = memorypa_pool_block_get_data(block);
-  if(pool == NULL) {
+  if(pool == NULL || pool == &memorypa_mapped_pool) {
     size_t offset = data - default_data;
     default_data = memorypa_rescue_reallocate_for_default_data(block, new_size + offset);
     if(default_data == NULL) {
       return default_data;
     }
+    if(memorypa_headerless && offset) {
+      memorypa_aligned_table_remove(data);
+    }
     data = default_data + offset;
     size_t new_offset = (size_t)default_data & (alignment - 1);
     if(new_offset) {
@@ -783,17 +3698,16 @@ static inline unsigned char * memorypa_own_aligned_realloc(unsigned char *data,
     if(new_data != data) {
       new_size -= new_offset;
       memmove(new_data, data, new_size);
-      memorypa_pool_block_set_data_offset(new_data, (unsigned short)new_offset);
     }
-    memorypa_write_message("memorypa: This is a rescued allocation! Using the given \"realloc\". (6)\n", MEMORYPA_WRITE_OPTION_STDERR);
+    // There's always room in the aligned table for the entry removed above:
+    memorypa_pool_block_set_data_offset(new_data, (unsigned short)new_offset);
+    if(pool == NULL) {
+      memorypa_event_record(6, 0, new_size);
+    }
     return new_data;
   }
-  size_t power = memorypa_own_msb(new_size);
-  unsigned char *new_pool = memorypa_pool_list[power - 1];
-  if(new_pool != NULL) {
-    power = memorypa_adjust_msb(new_size, power, memorypa_pool_get_block_padding(new_pool));
-  }
-  new_pool = memorypa_pool_list[power];
+  size_t size_class = memorypa_own_route(new_size);
+  unsigned char *new_pool = memorypa_class_get_pool(size_class);
   if(new_pool == NULL) {
     unsigned char *new_data = memorypa_rescue_allocate_for_data(new_size);
     if(new_data != NULL) {
@@ -803,16 +3717,17 @@ static inline unsigned char * memorypa_own_aligned_realloc(unsigned char *data,
       }
       new_data += offset;
       new_size -= offset;
-      memorypa_pool_block_set_data_offset(new_data, (unsigned short)offset);
+      if(!memorypa_pool_block_set_data_offset(new_data, (unsigned short)offset)) {
+        memorypa_given_free(new_data - offset);
+        return NULL;
+      }
       size_t offset_size = memorypa_pool_get_block_size(pool) - (data - default_data);
       memcpy(new_data, data, offset_size < new_size ? offset_size : new_size);
-      memorypa_pool_deallocate(block);
+      memorypa_thread_cache_deallocate(block);
+    }
+    if(!memorypa_mapping_serves(new_size)) {
+      memorypa_event_record(7, size_class, new_size);
     }
-    memorypa_write_message("memorypa: Pool #", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(power, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" has not been initialized for size ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(new_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message("! (7)\n", MEMORYPA_WRITE_OPTION_STDERR);
     return new_data;
   }
   if(pool == new_pool) {
@@ -829,7 +3744,7 @@ static inline unsigned char * memorypa_own_aligned_realloc(unsigned char *data,
     }
     return new_data;
   }
-  unsigned char *new_data = memorypa_pool_allocate(new_pool);
+  unsigned char *new_data = memorypa_thread_cache_allocate(new_pool);
   if(new_data == NULL) {
     new_data = memorypa_rescue_allocate_for_data(new_size);
     if(new_data != NULL) {
@@ -839,16 +3754,15 @@ static inline unsigned char * memorypa_own_aligned_realloc(unsigned char *data,
       }
       new_data += offset;
       new_size -= offset;
-      memorypa_pool_block_set_data_offset(new_data, (unsigned short)offset);
+      if(!memorypa_pool_block_set_data_offset(new_data, (unsigned short)offset)) {
+        memorypa_given_free(new_data - offset);
+        return NULL;
+      }
       size_t offset_size = memorypa_pool_get_block_size(pool) - (data - default_data);
       memcpy(new_data, data, offset_size < new_size ? offset_size : new_size);
-      memorypa_pool_deallocate(block);
+      memorypa_thread_cache_deallocate(block);
     }
-    memorypa_write_message("memorypa: Pool #", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(power, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" is out of memory for size ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(new_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message("! (8)\n", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_event_record(8, size_class, new_size);
   }
   else {
     new_data = memorypa_pool_block_get_data(new_data);
@@ -861,12 +3775,15 @@ static inline unsigned char * memorypa_own_aligned_realloc(unsigned char *data,
     memorypa_pool_block_set_data_offset(new_data, (unsigned short)offset);
     size_t offset_size = memorypa_pool_get_block_size(pool) - (data - default_data);
     memcpy(new_data, data, offset_size < new_size ? offset_size : new_size);
-    memorypa_pool_deallocate(block);
+    memorypa_thread_cache_deallocate(block);
   }
   return new_data;
 }
 
 static inline unsigned char * memorypa_own_profile_aligned_malloc(size_t size, unsigned short alignment) {
+  if(alignment <= memorypa_block_alignment) {
+    return memorypa_profile_allocate(size);
+  }
   unsigned char *data = memorypa_profile_allocate(size + alignment - 1);
   if(data != NULL) {
     size_t offset = (size_t)data & (alignment - 1);
@@ -874,7 +3791,7 @@ static inline unsigned char * memorypa_own_profile_aligned_malloc(size_t size, u
       offset = alignment - offset;
       data += offset;
       // This function is intentionally recycled:
-      memorypa_pool_block_set_data_offset(data, (unsigned short)offset);
+      memorypa_data_set_offset(data, (unsigned short)offset);
     }
   }
   return data;
@@ -940,6 +3857,209 @@ int memorypa_write_message(const char *message, int write_option) {
   return memorypa_write(write_option, message, (unsigned int)(strlen(message)));
 }
 
+/*
+  Pools may be configured at run time, without a rebuild, through the
+  "MEMORYPA_POOLS" environment variable or a file named by
+  "MEMORYPA_CONFIG". Either one replaces the pools of
+  "memorypa_initializer_options" (but not its functions). Pools are
+  separated by commas, whitespace or line breaks, and "#" comments out
+  the rest of a line. Each pool is "power:amount" followed by any of:
+
+  +N cache
+  /N steps
+  ^N segments
+  %N padding
+  l  lock-free
+  q  queue lock
+  i  intrusive free list
+  e  exact
+  c  per-CPU
+  p  prefetch
+
+  E.g. "7:500,8:200+16,12:100/4i". This runs within the first "malloc",
+  so nothing gets allocated: the file is read with a raw "read" into a
+  buffer of "MEMORYPA_CONFIG_SIZE" bytes on the stack.
+*/
+static inline void memorypa_config_report(const char *message, size_t position) {
+  memorypa_write_message("memorypa: Invalid configuration at byte ", MEMORYPA_WRITE_OPTION_STDERR);
+  memorypa_write_decimal(position, 0, MEMORYPA_WRITE_OPTION_STDERR);
+  memorypa_write_message("! ", MEMORYPA_WRITE_OPTION_STDERR);
+  memorypa_write_message(message, MEMORYPA_WRITE_OPTION_STDERR);
+  memorypa_write_message("\n", MEMORYPA_WRITE_OPTION_STDERR);
+}
+
+/*
+  The parser and the reader return what's wrong, if anything, and leave
+  it to the caller to report it: initialization exits, while merging a
+  profile merely fails. Parse errors also leave the byte they were found
+  at in "position".
+*/
+static inline const char * memorypa_config_parse_number(const char *config, size_t length, size_t *position, size_t *output) {
+  size_t start = *position;
+  *output = 0;
+  while(*position < length && config[*position] >= '0' && config[*position] <= '9') {
+    if(*output > (((size_t)-1) - (size_t)(config[*position] - '0')) / 10) {
+      *position = start;
+      return "Numbers must fit in a machine word.";
+    }
+    *output = (*output * 10) + (size_t)(config[*position] - '0');
+    ++*position;
+  }
+  if(*position == start) {
+    return "Expected a number.";
+  }
+  return NULL;
+}
+
+static inline const char * memorypa_config_parse(const char *config, size_t length, memorypa_pool_options *sets_of_options, size_t *position) {
+  memorypa_pool_options *options = NULL;
+  size_t count = 0;
+  size_t number;
+  const char *invalid = NULL;
+  char character;
+  *position = 0;
+  memset(sets_of_options, 0, memorypa_size_t_bit_size * sizeof(memorypa_pool_options));
+  while(invalid == NULL && *position < length) {
+    character = config[*position];
+    if(character == '#') {
+      while(*position < length && config[*position] != '\n') {
+        ++*position;
+      }
+    }
+    else if(character == ',' || character == ' ' || character == '\t' || character == '\r' || character == '\n') {
+      ++*position;
+      options = NULL;
+    }
+    else if(options == NULL) {
+      // The options were zeroed, so the last power always stays null:
+      if(count == memorypa_size_t_bit_size - 1) {
+        return "Too many pools.";
+      }
+      options = sets_of_options + count++;
+      if((invalid = memorypa_config_parse_number(config, length, position, &number)) != NULL) {
+        return invalid;
+      }
+      if(!number || number > 0xff) {
+        return "Powers must be between 1 and 255.";
+      }
+      options->power = (unsigned char)number;
+      if(*position == length || config[*position] != ':') {
+        return "Expected a colon after the power.";
+      }
+      ++*position;
+      invalid = memorypa_config_parse_number(config, length, position, &options->amount);
+    }
+    else {
+      ++*position;
+      switch(character) {
+        case '+':
+          invalid = memorypa_config_parse_number(config, length, position, &options->cache);
+          break;
+        case '/':
+          invalid = memorypa_config_parse_number(config, length, position, &number);
+          options->steps = number > 0xff ? 0xff : (unsigned char)number;
+          break;
+        case '^':
+          invalid = memorypa_config_parse_number(config, length, position, &number);
+          options->segments = number > 0xff ? 0xff : (unsigned char)number;
+          break;
+        case '%':
+          invalid = memorypa_config_parse_number(config, length, position, &options->padding);
+          break;
+        case 'l':
+          options->synchronization = MEMORYPA_SYNCHRONIZATION_LOCK_FREE;
+          break;
+        case 'q':
+          options->synchronization = MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK;
+          break;
+        case 'i':
+          options->free_list = MEMORYPA_FREE_LIST_INTRUSIVE;
+          break;
+        case 'e':
+          options->exact = 1;
+          break;
+        case 'c':
+          options->per_cpu = 1;
+          break;
+        case 'p':
+          options->prefetch = 1;
+          break;
+        default:
+          --*position;
+          return "Unknown pool option.";
+      }
+    }
+  }
+  return invalid;
+}
+
+// Reads a whole file into "buffer", which holds "MEMORYPA_CONFIG_SIZE" bytes:
+static inline const char * memorypa_config_read(const char *path, char *buffer, size_t *length) {
+  *length = 0;
+  #ifdef _MSC_VER
+  int file = _open(path, _O_RDONLY | _O_BINARY);
+  #else
+  int file = open(path, O_RDONLY);
+  #endif
+  if(file < 0) {
+    return "memorypa: Cannot open the configuration file!\n";
+  }
+  #ifdef _MSC_VER
+  int amount;
+  while((amount = _read(file, buffer + *length, (unsigned int)(MEMORYPA_CONFIG_SIZE - *length))) > 0) {
+  #else
+  ssize_t amount;
+  while((amount = read(file, buffer + *length, MEMORYPA_CONFIG_SIZE - *length)) > 0) {
+  #endif
+    *length += (size_t)amount;
+    if(*length == MEMORYPA_CONFIG_SIZE) {
+      break;
+    }
+  }
+  #ifdef _MSC_VER
+  _close(file);
+  #else
+  close(file);
+  #endif
+  if(*length == MEMORYPA_CONFIG_SIZE) {
+    return "memorypa: The configuration file must be smaller than MEMORYPA_CONFIG_SIZE!\n";
+  }
+  if(amount < 0) {
+    return "memorypa: Cannot read the configuration file!\n";
+  }
+  return NULL;
+}
+
+// Initialization can't go on with a broken configuration:
+static inline void memorypa_config_apply_parse(const char *config, size_t length, memorypa_pool_options *sets_of_options) {
+  size_t position;
+  const char *invalid = memorypa_config_parse(config, length, sets_of_options, &position);
+  if(invalid != NULL) {
+    memorypa_config_report(invalid, position);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static inline void memorypa_config_apply(memorypa_pool_options *sets_of_options) {
+  const char *config = getenv(MEMORYPA_CONFIG_INLINE_VARIABLE);
+  if(config != NULL) {
+    memorypa_config_apply_parse(config, strlen(config), sets_of_options);
+    return;
+  }
+  const char *path = getenv(MEMORYPA_CONFIG_FILE_VARIABLE);
+  if(path == NULL || !*path) {
+    return;
+  }
+  char buffer[MEMORYPA_CONFIG_SIZE];
+  size_t length;
+  const char *invalid = memorypa_config_read(path, buffer, &length);
+  if(invalid != NULL) {
+    memorypa_write_message(invalid, MEMORYPA_WRITE_OPTION_STDERR);
+    exit(EXIT_FAILURE);
+  }
+  memorypa_config_apply_parse(buffer, length, sets_of_options);
+}
+
 unsigned char memorypa_initialize() {
   // Test atomic functions:
   unsigned char lock = 0;
@@ -994,23 +4114,38 @@ unsigned char memorypa_initialize() {
   memorypa_size_t_bit_size = memorypa_size_t_size * memorypa_u_char_bit_size;
   memorypa_size_t_half_bit_size = memorypa_size_t_bit_size / 2;
   memorypa_u_char_p_size = sizeof(unsigned char *);
+  memorypa_u_int_size = sizeof(unsigned int);
+  memorypa_u_long_long_size = sizeof(unsigned long long);
   // Prepare offsets:
   memorypa_2st = 2 * memorypa_size_t_size;
-  memorypa_1uc_4st_1ucp = memorypa_u_char_size + (4 * memorypa_size_t_size) + memorypa_u_char_p_size;
   memorypa_1ucp_2uc = memorypa_u_char_p_size + (2 * memorypa_u_char_size);
-  memorypa_1uc_1st = memorypa_u_char_size + memorypa_size_t_size;
-  memorypa_1uc_2st = memorypa_u_char_size + (2 * memorypa_size_t_size);
-  memorypa_1uc_3st = memorypa_u_char_size + (3 * memorypa_size_t_size);
-  memorypa_1uc_4st = memorypa_u_char_size + (4 * memorypa_size_t_size);
+  memorypa_1ull = memorypa_u_long_long_size;
+  memorypa_1ull_1st = memorypa_1ull + memorypa_size_t_size;
+  memorypa_1ull_1st_1ucp = memorypa_1ull_1st + memorypa_u_char_p_size;
+  memorypa_1ull_1st_1ucp_3ui = memorypa_1ull_1st_1ucp + (3 * memorypa_u_int_size);
+  memorypa_1ull_1st_1ucp_3ui_1uc = memorypa_1ull_1st_1ucp_3ui + memorypa_u_char_size;
+  memorypa_1ull_1st_1ucp_4ui = memorypa_1ull_1st_1ucp + (4 * memorypa_u_int_size);
+  memorypa_1ull_1st_1ucp_4ui_1ull = memorypa_1ull_1st_1ucp_4ui + memorypa_u_long_long_size;
+  memorypa_1ull_1st_1ucp_4ui_1ull_1ucp = memorypa_1ull_1st_1ucp_4ui_1ull + memorypa_u_char_p_size;
+  memorypa_1cl = MEMORYPA_CACHE_LINE_SIZE;
+  memorypa_1cl_1st = memorypa_1cl + memorypa_size_t_size;
+  memorypa_1cl_2st = memorypa_1cl + (2 * memorypa_size_t_size);
+  memorypa_1cl_3st = memorypa_1cl + (3 * memorypa_size_t_size);
+  memorypa_1cl_4st = memorypa_1cl + (4 * memorypa_size_t_size);
+  memorypa_1cl_5st = memorypa_1cl + (5 * memorypa_size_t_size);
+  memorypa_1cl_6st = memorypa_1cl + (6 * memorypa_size_t_size);
+  memorypa_1cl_6st_1ucp = memorypa_1cl_6st + memorypa_u_char_p_size;
+  memorypa_1cl_6st_1ucp_1uc = memorypa_1cl_6st_1ucp + memorypa_u_char_size;
+  memorypa_1cl_6st_1ucp_2uc = memorypa_1cl_6st_1ucp + (2 * memorypa_u_char_size);
+  memorypa_1cl_6st_1ucp_3uc = memorypa_1cl_6st_1ucp + (3 * memorypa_u_char_size);
+  memorypa_1cl_6st_1ucp_4uc = memorypa_1cl_6st_1ucp + (4 * memorypa_u_char_size);
+  memorypa_2cl = 2 * MEMORYPA_CACHE_LINE_SIZE;
   memorypa_2uc = 2 * memorypa_u_char_size;
-  memorypa_1ucp_1uc = memorypa_u_char_p_size + memorypa_u_char_size;
   memorypa_1st_2uc = memorypa_size_t_size + (2 * memorypa_u_char_size);
-  memorypa_1st_1uc = memorypa_size_t_size + memorypa_u_char_size;
-  // Prepare list sizes:
-  memorypa_profile_list_size = memorypa_size_t_bit_size * memorypa_2st;
-  memorypa_pool_list_size = memorypa_size_t_bit_size * memorypa_u_char_p_size;
+  memorypa_1st_1ucp = memorypa_size_t_size + memorypa_u_char_p_size;
   // Retrieve configuration:
   memorypa_functions functions;
+  memset(&functions, 0, sizeof(memorypa_functions));
   memorypa_pool_options *sets_of_pool_options;
   switch(memorypa_size_t_bit_size) {
     case 32:
@@ -1039,10 +4174,25 @@ unsigned char memorypa_initialize() {
   #else
   memorypa_initializer_options(&functions, sets_of_pool_options);
   #endif
+  memorypa_config_apply(sets_of_pool_options);
   // Recover original allocation functions:
   memorypa_given_malloc = functions.malloc;
   memorypa_given_realloc = functions.realloc;
   memorypa_given_free = functions.free;
+  // Pad the block and profile headers so that data starts aligned (header-less blocks have none):
+  memorypa_block_alignment = functions.native_alignment ? MEMORYPA_NATIVE_ALIGNMENT : 1;
+  memorypa_headerless = functions.headerless;
+  memorypa_huge_pages_requested = functions.huge_pages;
+  memorypa_trim_advice = functions.trim;
+  memorypa_profile_histogram = functions.profile_histogram;
+  memorypa_trim_threshold = functions.trim_threshold;
+  memorypa_mapping_threshold = memorypa_headerless ? (size_t)-1 : (functions.mapping_threshold ? functions.mapping_threshold : MEMORYPA_MAPPING_THRESHOLD);
+  memorypa_block_header_size = memorypa_headerless ? 0 : memorypa_round_up_to_block_alignment(memorypa_1ucp_2uc);
+  memorypa_profile_sample_rate = functions.profile_sample_rate;
+  memorypa_profile_header_size = memorypa_round_up_to_block_alignment(memorypa_profile_sample_rate ? memorypa_2st + memorypa_2uc : memorypa_1st_2uc);
+  memorypa_mapping_header_size = memorypa_round_up_to_block_alignment(memorypa_size_t_size);
+  memorypa_arena_chunk_header_size = memorypa_round_up_to_block_alignment(memorypa_u_char_p_size << 1);
+  memorypa_arena_header_size = memorypa_round_up_to_block_alignment((memorypa_u_char_p_size * 6) + memorypa_size_t_size);
   // For MSB function:
   memorypa_size_t_half_bit_size_next_power = 1;
   while(memorypa_size_t_half_bit_size > (memorypa_size_t_half_bit_size_next_power <<= 1));
@@ -1064,75 +4214,332 @@ unsigned char memorypa_initialize() {
     memorypa_write_message("memorypa: Failed to get positive thread ID!\n", MEMORYPA_WRITE_OPTION_STDERR);
     exit(EXIT_FAILURE);
   }
+  // Count the CPUs for per-CPU pools:
+  #ifdef _MSC_VER
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  memorypa_cpu_count = system_info.dwNumberOfProcessors ? system_info.dwNumberOfProcessors : 1;
+  memorypa_cpu_online_count = memorypa_cpu_count;
+  memorypa_page_size = system_info.dwPageSize ? system_info.dwPageSize : 4096;
+  #else
+  long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+  long cpu_online_count = sysconf(_SC_NPROCESSORS_ONLN);
+  memorypa_cpu_count = cpu_count > 0 ? (size_t)cpu_count : 1;
+  memorypa_cpu_online_count = cpu_online_count > 0 ? (size_t)cpu_online_count : 1;
+  long page_size = sysconf(_SC_PAGESIZE);
+  memorypa_page_size = page_size > 0 ? (size_t)page_size : 4096;
+  #endif
   // Prepare the pool:
   memorypa_pools_initialize(sets_of_pool_options);
+  memorypa_route_table_initialize();
+  memorypa_thread_cache_initialize();
+  memorypa_events_initialize();
   // Trigger pooling:
   memorypa_lock_test_set(&memorypa_initialized);
+  #ifdef MEMORYPA_BACKTRACE
+  // The first "backtrace" loads the unwinder, which allocates, so get that over with:
+  if(memorypa_profile_sample_rate) {
+    void *frames[MEMORYPA_PROFILE_DEPTH];
+    backtrace(frames, MEMORYPA_PROFILE_DEPTH);
+  }
+  #endif
+  // Recursion can't happen anymore, so let this thread initialize again after a "memorypa_destroy":
+  memorypa_lock(&memorypa_initializer_thread_id_lock);
+  memorypa_initializer_thread_id = 0;
+  memorypa_unlock(&memorypa_initializer_thread_id_lock);
   // Initialization is complete:
   memorypa_unlock(&memorypa_initializing);
   return 1;
 }
 
-unsigned char memorypa_pools_are_invalid() {
-  size_t output_pool_size;
-  size_t i = 0;
-  do {
-    if(memorypa_pool_list[i] != NULL) {
-      if(memorypa_pool_is_invalid(memorypa_pool_list[i], &output_pool_size)) {
-        return 1;
+unsigned char memorypa_pools_are_invalid() {
+  size_t output_pool_size;
+  size_t i = 0;
+  do {
+    if(memorypa_class_get_pool(i) != NULL) {
+      if(memorypa_pool_is_invalid(memorypa_class_get_pool(i), &output_pool_size)) {
+        return 1;
+      }
+    }
+  }
+  while(++i < memorypa_class_count);
+  size_t total_size = memorypa_pools_offset;
+  unsigned char *current_pool = memorypa_everything + total_size;
+  do {
+    if(memorypa_pool_is_invalid(current_pool, &output_pool_size)) {
+      return 2;
+    }
+    current_pool += output_pool_size;
+    total_size += output_pool_size;
+  }
+  while(total_size < memorypa_everything_size);
+  if(total_size != memorypa_everything_size) {
+    memorypa_write_message("memorypa: The calculated total size is off: ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_decimal(total_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message(" vs. ", MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_decimal(memorypa_everything_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
+    memorypa_write_message("!\n", MEMORYPA_WRITE_OPTION_STDERR);
+    return 3;
+  }
+  return 0;
+}
+
+/*
+  "Metadata" counts every byte of a pool that isn't block data: the
+  header, the free block list, each block's pool pointer and terminator,
+  and the padding up to the next cache line. "Saved" is what the
+  intrusive free list spares compared to the regular one. The free count
+  of a lock-free pool is a snapshot.
+*/
+void memorypa_pools_print() {
+  if(memorypa_class_list == NULL) {
+    return;
+  }
+  size_t total_size = memorypa_pools_offset;
+  unsigned char *pool = memorypa_everything + total_size;
+  size_t block_size, block_padding, block_amount, free_blocks, pool_size, saved, link, metadata;
+  unsigned char free_list;
+  unsigned char *segment;
+  memorypa_write_message("memorypa: Current pools:\n", MEMORYPA_WRITE_OPTION_STDOUT);
+  memorypa_write_message("memorypa:    Size   Padding    Amount      Free  Metadata     Saved\n", MEMORYPA_WRITE_OPTION_STDOUT);
+  while(total_size < memorypa_everything_size) {
+    block_size = memorypa_pool_get_block_size(pool);
+    block_padding = memorypa_pool_get_block_padding(pool);
+    block_amount = memorypa_pool_get_block_amount(pool);
+    free_list = memorypa_pool_get_free_list(pool);
+    pool_size = memorypa_pool_get_total_size(block_size, block_amount, free_list);
+    // Blocks that were never carved are free too:
+    free_blocks = block_amount - (size_t)memorypa_free_block_head_load(memorypa_pool_get_carved_blocks(pool));
+    metadata = pool_size - (block_size * block_amount);
+    if(memorypa_pool_get_synchronization(pool) == MEMORYPA_SYNCHRONIZATION_LOCK_FREE) {
+      link = memorypa_free_block_head_get_link(memorypa_free_block_head_load(memorypa_pool_get_free_block_head(pool)));
+      while(link && link <= block_amount && free_blocks < block_amount) {
+        ++free_blocks;
+        link = memorypa_free_block_link_load(memorypa_pool_free_block_list_at(memorypa_pool_get_free_block_list(pool), link - 1));
+      }
+    }
+    else {
+      memorypa_pool_lock(pool);
+      free_blocks += memorypa_pool_get_free_blocks(pool);
+      // Count the segments of growable pools in too:
+      segment = memorypa_pool_get_segment_list(pool);
+      while(segment != NULL) {
+        block_amount += memorypa_segment_get_amount(segment);
+        metadata += memorypa_segment_get_total_size(block_size, memorypa_segment_get_amount(segment)) - (block_size * memorypa_segment_get_amount(segment));
+        segment = memorypa_segment_get_next(segment);
+      }
+      memorypa_pool_unlock(pool);
+    }
+    saved = free_list == MEMORYPA_FREE_LIST_INTRUSIVE ? memorypa_u_char_p_size * block_amount : 0;
+    memorypa_write_message("memorypa: ", MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_decimal(block_size - block_padding, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_decimal(block_padding, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_decimal(block_amount, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_decimal(free_blocks, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_decimal(metadata, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_decimal(saved, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_message("\n", MEMORYPA_WRITE_OPTION_STDOUT);
+    pool += pool_size;
+    total_size += pool_size;
+  }
+}
+
+/*
+  Keeps the "keep_bytes" worth of blocks freed most recently in every
+  pool, and trims the rest. Blocks sitting in thread caches or per-CPU
+  slices aren't free as far as their pools know, so they stay resident.
+  Returns how many bytes went back to the operating system.
+*/
+size_t memorypa_trim(size_t keep_bytes) {
+  if(memorypa_class_list == NULL) {
+    return 0;
+  }
+  unsigned char *previous = NULL;
+  unsigned char *pool;
+  size_t output = 0;
+  size_t i = 0;
+  do {
+    pool = memorypa_class_get_pool(i);
+    if(pool != NULL && pool != previous) {
+      previous = pool;
+      if(memorypa_pool_get_trim(pool)) {
+        memorypa_pool_lock(pool);
+        output += memorypa_pool_trim(pool, keep_bytes / memorypa_pool_get_block_stride(memorypa_pool_get_block_size(pool)));
+        memorypa_pool_unlock(pool);
+      }
+    }
+  }
+  while(++i < memorypa_class_count);
+  return output;
+}
+
+size_t memorypa_events_drain(memorypa_event *events, size_t amount) {
+  size_t output = 0;
+  size_t head, sequence, *slot;
+  memorypa_lock(&memorypa_events_lock);
+  head = memorypa_event_load(&memorypa_events_head);
+  // Writers lapped the reader, so the oldest events are gone:
+  if(head - memorypa_events_tail > MEMORYPA_EVENTS_SIZE) {
+    memorypa_events_dropped += head - memorypa_events_tail - MEMORYPA_EVENTS_SIZE;
+    memorypa_events_tail = head - MEMORYPA_EVENTS_SIZE;
+  }
+  while(output < amount && memorypa_events_tail != head) {
+    slot = memorypa_events + ((memorypa_events_tail & (MEMORYPA_EVENTS_SIZE - 1)) << 2);
+    sequence = memorypa_event_load(slot);
+    // Still being written, so try again on the next drain:
+    if(!sequence) {
+      break;
+    }
+    // Left over from an earlier lap, so a slow writer stored it over the
+    // event of this ticket, or this ticket's writer has yet to start:
+    if(sequence < memorypa_events_tail + 1) {
+      ++memorypa_events_dropped;
+      ++memorypa_events_tail;
+      continue;
+    }
+    events[output].site = (unsigned char)memorypa_event_load(slot + 1);
+    events[output].size_class = memorypa_event_load(slot + 2);
+    events[output].size = memorypa_event_load(slot + 3);
+    memorypa_event_fence();
+    // Overwritten before or while it was read:
+    if(sequence != memorypa_events_tail + 1 || memorypa_event_load(slot) != sequence || events[output].site > 8) {
+      ++memorypa_events_dropped;
+    }
+    else {
+      events[output].kind = memorypa_event_kinds[events[output].site];
+      ++output;
+    }
+    ++memorypa_events_tail;
+  }
+  memorypa_unlock(&memorypa_events_lock);
+  return output;
+}
+
+/*
+  Prints whatever is left in the ring, then one line per class that had
+  to be rescued. A storm of rescues thus costs a bounded amount of output
+  instead of a line each.
+*/
+void memorypa_events_print() {
+  memorypa_event events[16];
+  size_t amount, i;
+  memorypa_write_message("memorypa: Recent events:\n", MEMORYPA_WRITE_OPTION_STDOUT);
+  while((amount = memorypa_events_drain(events, 16))) {
+    i = 0;
+    do {
+      if(events[i].kind == MEMORYPA_EVENT_RESCUED_REALLOC) {
+        memorypa_write_message("memorypa: This is a rescued allocation! Using the given \"realloc\". (", MEMORYPA_WRITE_OPTION_STDOUT);
+      }
+      else {
+        memorypa_write_message("memorypa: Pool #", MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_decimal(events[i].size_class, 0, MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_message(events[i].kind == MEMORYPA_EVENT_OUT_OF_MEMORY ? " is out of memory for size " : " has not been initialized for size ", MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_decimal(events[i].size, 0, MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_message("! (", MEMORYPA_WRITE_OPTION_STDOUT);
       }
+      memorypa_write_decimal(events[i].site, 0, MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_message(")\n", MEMORYPA_WRITE_OPTION_STDOUT);
     }
+    while(++i < amount);
   }
-  while(++i < memorypa_size_t_bit_size);
-  size_t total_size = memorypa_profile_list_size + memorypa_pool_list_size;
-  unsigned char *current_pool = memorypa_everything + total_size;
+  memorypa_lock(&memorypa_events_lock);
+  amount = memorypa_events_dropped;
+  memorypa_unlock(&memorypa_events_lock);
+  memorypa_write_message("memorypa: Dropped events: ", MEMORYPA_WRITE_OPTION_STDOUT);
+  memorypa_write_decimal(amount, 0, MEMORYPA_WRITE_OPTION_STDOUT);
+  memorypa_write_message("\nmemorypa: Rescued reallocations: ", MEMORYPA_WRITE_OPTION_STDOUT);
+  memorypa_write_decimal(memorypa_event_load(&memorypa_events_rescued), 0, MEMORYPA_WRITE_OPTION_STDOUT);
+  memorypa_write_message("\n", MEMORYPA_WRITE_OPTION_STDOUT);
+  if(memorypa_rescue_list == NULL) {
+    return;
+  }
+  size_t out_of_memory, not_initialized;
+  memorypa_write_message("memorypa: Rescues per pool:\n", MEMORYPA_WRITE_OPTION_STDOUT);
+  memorypa_write_message("memorypa:    Pool  Exhausted  Missing\n", MEMORYPA_WRITE_OPTION_STDOUT);
+  i = 0;
   do {
-    if(memorypa_pool_is_invalid(current_pool, &output_pool_size)) {
-      return 2;
+    out_of_memory = memorypa_rescue_get_out_of_memory(i);
+    not_initialized = memorypa_rescue_get_not_initialized(i);
+    if(out_of_memory || not_initialized) {
+      memorypa_write_message("memorypa: ", MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_decimal(i, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_message("    ", MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_decimal(out_of_memory, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_message("  ", MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_decimal(not_initialized, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_message("\n", MEMORYPA_WRITE_OPTION_STDOUT);
     }
-    current_pool += output_pool_size;
-    total_size += output_pool_size;
-  }
-  while(total_size < memorypa_everything_size);
-  if(total_size != memorypa_everything_size) {
-    memorypa_write_message("memorypa: The calculated total size is off: ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(total_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message(" vs. ", MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_decimal(memorypa_everything_size, 0, MEMORYPA_WRITE_OPTION_STDERR);
-    memorypa_write_message("!\n", MEMORYPA_WRITE_OPTION_STDERR);
-    return 3;
   }
-  return 0;
+  while(++i < memorypa_class_count);
 }
 
 void memorypa_destroy() {
   memorypa_lock(&memorypa_initializing);
-  if(memorypa_pool_list != NULL) {
+  if(memorypa_class_list != NULL) {
     unsigned char *previous = NULL;
+    unsigned char *pool;
     size_t i = 0;
     do {
       /*
-        All pools must be locked before a clean "free" can happen. Pool
+        All pools must be locked before a clean "free" can happen. Class
         assignment is always in ascending order of block size even when a
-        single pool sits across multiple indices. Track the "previous" to
+        single pool sits across multiple classes. Track the "previous" to
         prevent deadlocks.
       */
-      if(memorypa_pool_list[i] != NULL && memorypa_pool_list[i] != previous) {
-        memorypa_pool_lock(memorypa_pool_list[i]);
-        previous = memorypa_pool_list[i];
+      pool = memorypa_class_get_pool(i);
+      if(pool != NULL && pool != previous) {
+        memorypa_pool_lock(pool);
+        previous = pool;
+      }
+    }
+    while(++i < memorypa_class_count);
+    size_t total_size = memorypa_pools_offset;
+    size_t pool_size;
+    pool = memorypa_everything + total_size;
+    while(total_size < memorypa_everything_size) {
+      pool_size = memorypa_pool_get_total_size(memorypa_pool_get_block_size(pool), memorypa_pool_get_block_amount(pool), memorypa_pool_get_free_list(pool));
+      memorypa_pool_release_segments(pool);
+      // Only wipe what was written, so that untouched pages stay untouched:
+      if(!memorypa_everything_mapped_size) {
+        memorypa_pool_clear(pool);
       }
+      pool += pool_size;
+      total_size += pool_size;
     }
-    while(++i < memorypa_size_t_bit_size);
-    memset(memorypa_everything, 0, memorypa_everything_size);
-    memorypa_given_free(memorypa_everything);
+    if(memorypa_everything_mapped_size) {
+      // The operating system takes back mapped pages as they are:
+      memorypa_everything_unmap();
+    }
+    else {
+      memset(memorypa_everything, 0, memorypa_pools_offset);
+      memorypa_given_free(memorypa_everything_given);
+    }
+    memorypa_everything_given = NULL;
     memorypa_everything = NULL;
     memorypa_everything_size = 0;
-    memorypa_pool_list = NULL;
+    memorypa_class_list = NULL;
+    memorypa_class_count = 0;
+    memorypa_rescue_list = NULL;
+    memorypa_profile_site_list = NULL;
     memorypa_unlock_clear(&memorypa_initialized);
+    if(memorypa_thread_cache != NULL) {
+      memorypa_thread_cache_discard();
+    }
   }
   memorypa_unlock(&memorypa_initializing);
 }
 
+void memorypa_thread_cache_flush() {
+  if(memorypa_lock_load(&memorypa_initialized) && memorypa_thread_cache != NULL && memorypa_thread_cache_generation == memorypa_generation) {
+    memorypa_thread_cache_release(memorypa_thread_cache);
+  }
+}
+
 // Don't forget to initialize!
 size_t memorypa_get_size_t_size() {
   return memorypa_size_t_size;
@@ -1153,6 +4560,11 @@ size_t memorypa_get_u_char_bit_size() {
   return memorypa_u_char_bit_size;
 }
 
+// Don't forget to initialize!
+unsigned char memorypa_get_huge_pages() {
+  return memorypa_huge_pages;
+}
+
 // Don't forget to initialize!
 size_t memorypa_msb(size_t value) {
   return memorypa_own_msb(value);
@@ -1162,6 +4574,10 @@ size_t memorypa_get_thread_id() {
   return memorypa_own_get_thread_id();
 }
 
+size_t memorypa_get_cpu() {
+  return memorypa_own_get_cpu();
+}
+
 // Don't forget to initialize!
 size_t memorypa_mhash(size_t value) {
   size_t top_half = value >> memorypa_size_t_half_bit_size;
@@ -1200,6 +4616,18 @@ void * memorypa_malloc(size_t size) {
   return output;
 }
 
+size_t memorypa_malloc_batch(size_t size, size_t amount, void **output) {
+  if(memorypa_lock_load(&memorypa_initialized) || memorypa_initialize()) {
+    return memorypa_own_malloc_batch(size, amount, (unsigned char **)output);
+  }
+  size_t i = 0;
+  while(i < amount) {
+    output[i++] = memorypa_initializer_slab + memorypa_initializer_slab_index;
+    memorypa_initializer_slab_index += size;
+  }
+  return amount;
+}
+
 void * memorypa_aligned_malloc(size_t alignment, size_t size) {
   if(memorypa_lock_load(&memorypa_initialized) || memorypa_initialize()) {
     return memorypa_own_aligned_malloc(size, (unsigned short)alignment);
@@ -1243,6 +4671,16 @@ void * memorypa_realloc(void *data, size_t new_size) {
   return memorypa_own_realloc(data, new_size);
 }
 
+void * memorypa_realloc_sized(void *data, size_t size, size_t new_size) {
+  if(
+    (unsigned char *)data >= memorypa_initializer_slab
+    && (unsigned char *)data < memorypa_initializer_slab + MEMORYPA_INITIALIZER_SLAB_SIZE
+  ) {
+    return NULL;
+  }
+  return memorypa_own_realloc_sized(data, size, new_size);
+}
+
 void * memorypa_aligned_realloc(void *data, size_t alignment, size_t new_size) {
   if(
     (unsigned char *)data >= memorypa_initializer_slab
@@ -1263,6 +4701,109 @@ void memorypa_free(void *data) {
   memorypa_own_free(data);
 }
 
+void * memorypa_arena_create(size_t chunk_size) {
+  if(memorypa_lock_load(&memorypa_initialized) || memorypa_initialize()) {
+    return memorypa_own_arena_create(chunk_size);
+  }
+  return NULL;
+}
+
+void * memorypa_arena_malloc(void *arena, size_t size) {
+  return memorypa_own_arena_aligned_malloc((unsigned char *)arena, size, memorypa_block_alignment);
+}
+
+void * memorypa_arena_aligned_malloc(void *arena, size_t alignment, size_t size) {
+  return memorypa_own_arena_aligned_malloc((unsigned char *)arena, size, alignment);
+}
+
+void * memorypa_arena_mark(void *arena) {
+  return memorypa_arena_get_position((unsigned char *)arena);
+}
+
+void memorypa_arena_rewind(void *arena, void *mark) {
+  memorypa_own_arena_rewind((unsigned char *)arena, (unsigned char *)mark);
+}
+
+void memorypa_arena_reset(void *arena) {
+  memorypa_own_arena_reset((unsigned char *)arena);
+}
+
+void memorypa_arena_destroy(void *arena) {
+  if(arena != NULL) {
+    memorypa_own_arena_destroy((unsigned char *)arena);
+  }
+}
+
+memorypa_heap_t * memorypa_heap_create(memorypa_pool_options *sets_of_pool_options) {
+  if(memorypa_lock_load(&memorypa_initialized) || memorypa_initialize()) {
+    return (memorypa_heap_t *)memorypa_own_heap_create(sets_of_pool_options);
+  }
+  return NULL;
+}
+
+void * memorypa_heap_malloc(memorypa_heap_t *heap, size_t size) {
+  if(heap == NULL) {
+    return memorypa_malloc(size);
+  }
+  return memorypa_own_heap_malloc((unsigned char *)heap, size);
+}
+
+void * memorypa_heap_realloc(memorypa_heap_t *heap, void *data, size_t new_size) {
+  if(heap == NULL) {
+    return memorypa_realloc(data, new_size);
+  }
+  return memorypa_own_heap_realloc((unsigned char *)heap, (unsigned char *)data, new_size);
+}
+
+void memorypa_heap_free(memorypa_heap_t *heap, void *data) {
+  if(heap == NULL) {
+    memorypa_free(data);
+    return;
+  }
+  memorypa_own_heap_free((unsigned char *)heap, (unsigned char *)data);
+}
+
+void memorypa_heap_reset(memorypa_heap_t *heap) {
+  if(heap != NULL) {
+    memorypa_heap_release_segments((unsigned char *)heap);
+    memorypa_heap_pools_initialize((unsigned char *)heap);
+  }
+}
+
+void memorypa_heap_destroy(memorypa_heap_t *heap) {
+  if(heap != NULL) {
+    memorypa_heap_release_segments((unsigned char *)heap);
+    memorypa_given_free(memorypa_heap_get_given((unsigned char *)heap));
+  }
+}
+
+void memorypa_free_sized(void *data, size_t size) {
+  if(
+    (unsigned char *)data >= memorypa_initializer_slab
+    && (unsigned char *)data < memorypa_initializer_slab + MEMORYPA_INITIALIZER_SLAB_SIZE
+  ) {
+    return;
+  }
+  memorypa_own_free_sized(data, size);
+}
+
+void memorypa_free_batch(void **data, size_t amount) {
+  size_t i = 0;
+  size_t j = 0;
+  // Data from the slab is skipped, in runs so that the rest still gets batched:
+  while(j < amount) {
+    if(
+      (unsigned char *)data[j] >= memorypa_initializer_slab
+      && (unsigned char *)data[j] < memorypa_initializer_slab + MEMORYPA_INITIALIZER_SLAB_SIZE
+    ) {
+      memorypa_own_free_batch((unsigned char **)data + i, j - i);
+      i = j + 1;
+    }
+    ++j;
+  }
+  memorypa_own_free_batch((unsigned char **)data + i, j - i);
+}
+
 size_t memorypa_malloc_usable_size(void *data) {
   if(
     (unsigned char *)data >= memorypa_initializer_slab
@@ -1273,10 +4814,14 @@ size_t memorypa_malloc_usable_size(void *data) {
   unsigned char *pool = memorypa_pool_block_get_block_from_data(data);
   // Calling "memorypa_pool_block_get_data" in case of alignment:
   unsigned char *default_data = memorypa_pool_block_get_data(pool);
-  pool = memorypa_pool_block_get_pool(pool);
+  unsigned char *block = pool;
+  pool = memorypa_pool_block_get_pool(block);
   if(pool == NULL) {
     return 0;
   }
+  if(pool == &memorypa_mapped_pool) {
+    return memorypa_mapping_get_size(block) - memorypa_mapping_header_size - memorypa_block_header_size - ((unsigned char *)data - default_data);
+  }
   return memorypa_pool_get_block_size(pool) - ((unsigned char *)data - default_data);
 }
 
@@ -1384,22 +4929,218 @@ size_t memorypa_profile_malloc_usable_size(void *data) {
   return memorypa_profile_real_get_size(real) - ((unsigned char *)data - default_data);
 }
 
+/*
+  Exporting turns the profile into pools. The maximum count of each class
+  goes to the power whose pool would serve its largest size, i.e. its
+  limit's most significant bit, and maxima merged from other profiles
+  (see "memorypa_profile_merge") raise those per power. The sum is an
+  upper bound, since classes rarely peak together.
+*/
+static inline void memorypa_profile_get_maxima(size_t *maxima) {
+  size_t power;
+  size_t max;
+  size_t i = 0;
+  memcpy(maxima, memorypa_profile_maxima, sizeof(memorypa_profile_maxima));
+  if(memorypa_class_list == NULL) {
+    return;
+  }
+  size_t *own = maxima + memorypa_size_t_bit_size + 1;
+  memset(own, 0, sizeof(memorypa_profile_maxima));
+  do {
+    power = memorypa_own_msb(memorypa_class_get_limit(i));
+    max = memorypa_profile_get_max(i);
+    own[power] += max;
+  }
+  while(++i < memorypa_class_count);
+  i = 0;
+  do {
+    if(own[i] > maxima[i]) {
+      maxima[i] = own[i];
+    }
+  }
+  while(++i <= memorypa_size_t_bit_size);
+}
+
+/*
+  Padding pool n - 1 by "padding" bytes catches the sizes of power n up to
+  2^(n - 1) - 1 + "padding". Whole buckets are counted exactly, and the
+  sizes with a slot of their own add what they can of a partial bucket,
+  so the result never overestimates.
+*/
+static inline size_t memorypa_profile_get_caught(size_t power, size_t padding) {
+  size_t *buckets = memorypa_profile_buckets + (power << MEMORYPA_PROFILE_BUCKETS_SHIFT);
+  size_t shift = memorypa_profile_get_bucket_shift(power);
+  size_t whole = padding >> shift;
+  size_t caught = 0;
+  size_t i = 0;
+  while(i < whole && i < MEMORYPA_PROFILE_BUCKETS) {
+    caught += memorypa_profile_load(buckets + i);
+    ++i;
+  }
+  if(i < MEMORYPA_PROFILE_BUCKETS && (padding & ((memorypa_one << shift) - 1))) {
+    size_t *slot = memorypa_profile_sizes + (power * (MEMORYPA_PROFILE_SIZES << 1));
+    size_t offset;
+    i = 0;
+    do {
+      offset = memorypa_profile_load(slot);
+      if(offset) {
+        offset = (offset - 1) & ((memorypa_one << (power - 1)) - 1);
+        if((offset >> shift) == whole && offset < padding) {
+          caught += memorypa_profile_load(slot + 1);
+        }
+      }
+      slot += 2;
+    }
+    while(++i < MEMORYPA_PROFILE_SIZES);
+  }
+  return caught;
+}
+
+/*
+  Weighs each padding of pool n - 1 that ends on a bucket or on a size
+  with a slot: the blocks it catches shrink from 2^n - 1 bytes to
+  2^(n - 1) - 1 + "padding", in proportion to the most that power n ever
+  held, while every block that pool n - 1 ever held grows by "padding".
+  Returns the padding that saves the most, if any, and what it saves.
+  Only powers that held something on both sides are weighed.
+*/
+static inline size_t memorypa_profile_get_padding(size_t power, size_t *maxima, size_t total, size_t *saved) {
+  size_t half = memorypa_one << (power - 1);
+  size_t shift = memorypa_profile_get_bucket_shift(power);
+  size_t *slot = memorypa_profile_sizes + (power * (MEMORYPA_PROFILE_SIZES << 1));
+  size_t best = 0;
+  size_t padding, caught, held, gain, loss;
+  size_t i = 0;
+  *saved = 0;
+  // Buckets first, then sizes with a slot:
+  do {
+    if(i < MEMORYPA_PROFILE_BUCKETS) {
+      padding = (i + 1) << shift;
+    }
+    else {
+      padding = memorypa_profile_load(slot + ((i - MEMORYPA_PROFILE_BUCKETS) << 1));
+      padding = padding ? ((padding - 1) & (half - 1)) + 1 : 0;
+    }
+    // Padding must stay below the next power:
+    if(padding && padding < half) {
+      caught = memorypa_profile_get_caught(power, padding);
+      held = (caught / total) * maxima[power] + ((caught % total) * maxima[power]) / total;
+      gain = held * (half - padding);
+      loss = maxima[power - 1] * padding;
+      if(gain > loss && gain - loss > *saved) {
+        *saved = gain - loss;
+        best = padding;
+      }
+    }
+  }
+  while(++i < MEMORYPA_PROFILE_BUCKETS + MEMORYPA_PROFILE_SIZES);
+  return best;
+}
+
+static inline void memorypa_profile_print_histogram() {
+  size_t maxima[((sizeof(size_t) * CHAR_BIT) + 1) << 1];
+  size_t sizes[MEMORYPA_PROFILE_SIZES];
+  size_t counts[MEMORYPA_PROFILE_SIZES];
+  size_t power, shift, half, total, count, padding, saved, used, i, j;
+  size_t *buckets;
+  size_t *slot;
+  memorypa_profile_get_maxima(maxima);
+  power = 1;
+  do {
+    buckets = memorypa_profile_buckets + (power << MEMORYPA_PROFILE_BUCKETS_SHIFT);
+    total = 0;
+    i = 0;
+    do {
+      total += memorypa_profile_load(buckets + i);
+    }
+    while(++i < MEMORYPA_PROFILE_BUCKETS);
+    if(!total) {
+      continue;
+    }
+    shift = memorypa_profile_get_bucket_shift(power);
+    half = memorypa_one << (power - 1);
+    memorypa_write_message("memorypa: Sizes of power ", MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_decimal(power, 0, MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_message(":\n", MEMORYPA_WRITE_OPTION_STDOUT);
+    memorypa_write_message("memorypa:    From        To     Count\n", MEMORYPA_WRITE_OPTION_STDOUT);
+    i = 0;
+    do {
+      count = memorypa_profile_load(buckets + i);
+      if(count) {
+        memorypa_write_message("memorypa: ", MEMORYPA_WRITE_OPTION_STDOUT);
+        // Power 1 also holds size 0:
+        memorypa_write_decimal(power == 1 ? 0 : half + (i << shift), 7, MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_decimal(half + ((i + 1) << shift) - 1, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_decimal(count, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_message("\n", MEMORYPA_WRITE_OPTION_STDOUT);
+      }
+    }
+    while(++i < MEMORYPA_PROFILE_BUCKETS);
+    // Sort the sizes with a slot by count, most frequent first:
+    slot = memorypa_profile_sizes + (power * (MEMORYPA_PROFILE_SIZES << 1));
+    used = 0;
+    while(used < MEMORYPA_PROFILE_SIZES && memorypa_profile_load(slot + (used << 1))) {
+      sizes[used] = memorypa_profile_load(slot + (used << 1)) - 1;
+      counts[used] = memorypa_profile_load(slot + (used << 1) + 1);
+      j = used++;
+      while(j && counts[j - 1] < counts[j]) {
+        count = counts[j - 1];
+        counts[j - 1] = counts[j];
+        counts[j] = count;
+        count = sizes[j - 1];
+        sizes[j - 1] = sizes[j];
+        sizes[j] = count;
+        --j;
+      }
+    }
+    if(used) {
+      memorypa_write_message("memorypa:    Size     Count\n", MEMORYPA_WRITE_OPTION_STDOUT);
+      i = 0;
+      do {
+        memorypa_write_message("memorypa: ", MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_decimal(sizes[i], 7, MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_decimal(counts[i], 7, MEMORYPA_WRITE_OPTION_STDOUT);
+        memorypa_write_message("\n", MEMORYPA_WRITE_OPTION_STDOUT);
+      }
+      while(++i < used);
+    }
+    if(power > 1 && maxima[power] && maxima[power - 1] && (padding = memorypa_profile_get_padding(power, maxima, total, &saved))) {
+      memorypa_write_message("memorypa: Padding power ", MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_decimal(power - 1, 0, MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_message(" by ", MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_decimal(padding, 0, MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_message(" catches ", MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_decimal((memorypa_profile_get_caught(power, padding) * 100) / total, 0, MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_message("% of these and saves about ", MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_decimal(saved, 0, MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_message(" bytes.\n", MEMORYPA_WRITE_OPTION_STDOUT);
+    }
+  }
+  while(++power <= memorypa_size_t_bit_size);
+}
+
 void memorypa_profile_print() {
+  if(memorypa_class_list == NULL) {
+    return;
+  }
   size_t i = 0;
-  size_t padding, count, max;
+  size_t limit, padding, count, max;
   unsigned char *pool;
   memorypa_write_message("memorypa: Current profile:\n", MEMORYPA_WRITE_OPTION_STDOUT);
-  memorypa_write_message("memorypa:   Power   Padding     Count       Max\n", MEMORYPA_WRITE_OPTION_STDOUT);
+  memorypa_write_message("memorypa:    Size   Padding     Count       Max\n", MEMORYPA_WRITE_OPTION_STDOUT);
   do {
-    memorypa_lock(&memorypa_profile_lock);
-    pool = memorypa_pool_list[i];
-    padding = pool == NULL ? 0 : memorypa_pool_get_block_padding(pool);
+    limit = memorypa_class_get_limit(i);
+    pool = memorypa_class_get_pool(i);
+    // Classes served by the next pool up don't include its padding:
+    padding = pool == NULL || memorypa_pool_get_block_size(pool) != limit ? 0 : memorypa_pool_get_block_padding(pool);
     count = memorypa_profile_get_count(i);
     max = memorypa_profile_get_max(i);
-    memorypa_unlock(&memorypa_profile_lock);
     if(max) {
       memorypa_write_message("memorypa: ", MEMORYPA_WRITE_OPTION_STDOUT);
-      memorypa_write_decimal(i, 7, MEMORYPA_WRITE_OPTION_STDOUT);
+      memorypa_write_decimal(limit - padding, 7, MEMORYPA_WRITE_OPTION_STDOUT);
       memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
       memorypa_write_decimal(padding, 7, MEMORYPA_WRITE_OPTION_STDOUT);
       memorypa_write_message("   ", MEMORYPA_WRITE_OPTION_STDOUT);
@@ -1409,5 +5150,276 @@ void memorypa_profile_print() {
       memorypa_write_message("\n", MEMORYPA_WRITE_OPTION_STDOUT);
     }
   }
-  while(++i < memorypa_size_t_bit_size);
+  while(++i < memorypa_class_count);
+  if(memorypa_profile_histogram) {
+    memorypa_profile_print_histogram();
+  }
+}
+
+static inline size_t memorypa_profile_get_amount(size_t max, size_t headroom) {
+  size_t extra = (max / 100) * headroom + ((max % 100) * headroom + 99) / 100;
+  return max + extra < max ? (size_t)-1 : max + extra;
+}
+
+/*
+  Picks which powers get a pool. A power without one is served by the
+  next pool up, which saves that pool's metadata and the rounding of its
+  last cache line, but costs a larger block for each of its allocations.
+  Over the powers in demand, "costs[j]" is the least that the powers up
+  to "j" can reserve when "j" gets a pool, and "serves[j]" is the lowest
+  power that this pool serves. Without solving, every power in demand
+  gets its own pool.
+*/
+static inline void memorypa_profile_solve(size_t *powers, size_t *amounts, size_t count, unsigned char solve, size_t *serves) {
+  size_t costs[(sizeof(size_t) * CHAR_BIT) + 1];
+  size_t cost, sum, i, j;
+  j = 0;
+  while(j < count) {
+    serves[j] = j;
+    costs[j] = (j ? costs[j - 1] : 0) + memorypa_pool_get_total_size((memorypa_one << powers[j]) - 1, amounts[j], MEMORYPA_FREE_LIST_ARRAY);
+    if(solve) {
+      sum = amounts[j];
+      i = j;
+      while(i--) {
+        sum += amounts[i];
+        cost = (i ? costs[i - 1] : 0) + memorypa_pool_get_total_size((memorypa_one << powers[j]) - 1, sum, MEMORYPA_FREE_LIST_ARRAY);
+        if(cost < costs[j]) {
+          costs[j] = cost;
+          serves[j] = i;
+        }
+      }
+    }
+    ++j;
+  }
+}
+
+static inline int memorypa_profile_export_write(int fd, const char *text) {
+  size_t length = strlen(text);
+  return MEMORYPA_WRITE(fd, text, (unsigned int)length) == (int)length ? 0 : -1;
+}
+
+static inline int memorypa_profile_export_write_decimal(int fd, size_t number) {
+  char digits[21];
+  char *digit_index = digits + 20;
+  *digit_index = 0;
+  do {
+    *(--digit_index) = (char)('0' + (number % 10));
+  }
+  while((number /= 10));
+  return memorypa_profile_export_write(fd, digit_index);
+}
+
+int memorypa_profile_export(int fd, int format, size_t headroom, unsigned char solve) {
+  size_t maxima[((sizeof(size_t) * CHAR_BIT) + 1) << 1];
+  size_t powers[(sizeof(size_t) * CHAR_BIT) + 1];
+  size_t amounts[(sizeof(size_t) * CHAR_BIT) + 1];
+  size_t serves[(sizeof(size_t) * CHAR_BIT) + 1];
+  size_t count = 0;
+  size_t i = 1;
+  int failed = 0;
+  memorypa_profile_get_maxima(maxima);
+  // Powers must stay below the number of bits in a machine word:
+  while(i < memorypa_size_t_bit_size) {
+    if(maxima[i]) {
+      powers[count] = i;
+      amounts[count++] = format == MEMORYPA_PROFILE_EXPORT_MAXIMA ? maxima[i] : memorypa_profile_get_amount(maxima[i], headroom);
+    }
+    ++i;
+  }
+  if(format != MEMORYPA_PROFILE_EXPORT_MAXIMA) {
+    memorypa_profile_solve(powers, amounts, count, solve, serves);
+    // Walk the chosen pools down from the top, folding in what they serve:
+    i = count;
+    size_t j;
+    while(i) {
+      j = serves[i - 1];
+      while(j < i - 1) {
+        amounts[i - 1] += amounts[j];
+        powers[j] = 0;
+        ++j;
+      }
+      i = serves[i - 1];
+    }
+  }
+  size_t index = 0;
+  i = 0;
+  while(i < count) {
+    if(powers[i]) {
+      if(format == MEMORYPA_PROFILE_EXPORT_C) {
+        failed |= memorypa_profile_export_write(fd, "  sets_of_pool_options[");
+        failed |= memorypa_profile_export_write_decimal(fd, index);
+        failed |= memorypa_profile_export_write(fd, "].power = ");
+        failed |= memorypa_profile_export_write_decimal(fd, powers[i]);
+        failed |= memorypa_profile_export_write(fd, ";\n  sets_of_pool_options[");
+        failed |= memorypa_profile_export_write_decimal(fd, index);
+        failed |= memorypa_profile_export_write(fd, "].amount = ");
+        failed |= memorypa_profile_export_write_decimal(fd, amounts[i]);
+        failed |= memorypa_profile_export_write(fd, ";\n");
+      }
+      else {
+        if(index) {
+          failed |= memorypa_profile_export_write(fd, ",");
+        }
+        failed |= memorypa_profile_export_write_decimal(fd, powers[i]);
+        failed |= memorypa_profile_export_write(fd, ":");
+        failed |= memorypa_profile_export_write_decimal(fd, amounts[i]);
+      }
+      ++index;
+    }
+    ++i;
+  }
+  if(format != MEMORYPA_PROFILE_EXPORT_C) {
+    failed |= memorypa_profile_export_write(fd, "\n");
+  }
+  return failed;
+}
+
+/*
+  Reads maxima exported by another run or process, and keeps the larger
+  of each power for the next export. They use the same syntax as the
+  pools of "MEMORYPA_CONFIG", so the amounts are the maxima. Returns -1,
+  with nothing merged, if the file can't be read or parsed.
+*/
+int memorypa_profile_merge(const char *path) {
+  if(!memorypa_lock_load(&memorypa_initialized) && !memorypa_initialize()) {
+    return -1;
+  }
+  memorypa_pool_options sets_of_options[(sizeof(size_t) * CHAR_BIT) + 1];
+  char buffer[MEMORYPA_CONFIG_SIZE];
+  size_t length;
+  const char *invalid = memorypa_config_read(path, buffer, &length);
+  if(invalid != NULL) {
+    memorypa_write_message(invalid, MEMORYPA_WRITE_OPTION_STDERR);
+    return -1;
+  }
+  invalid = memorypa_config_parse(buffer, length, sets_of_options, &length);
+  if(invalid != NULL) {
+    memorypa_config_report(invalid, length);
+    return -1;
+  }
+  // Nothing validates these powers as pools, so check them before merging any:
+  size_t i = 0;
+  while(i < memorypa_size_t_bit_size && sets_of_options[i].power) {
+    if(sets_of_options[i].power >= memorypa_size_t_bit_size) {
+      memorypa_write_message("memorypa: Cannot merge the profile! Powers must be smaller than the number of bits in a machine word!\n", MEMORYPA_WRITE_OPTION_STDERR);
+      return -1;
+    }
+    ++i;
+  }
+  i = 0;
+  while(i < memorypa_size_t_bit_size && sets_of_options[i].power) {
+    if(sets_of_options[i].amount > memorypa_profile_maxima[sets_of_options[i].power]) {
+      memorypa_profile_maxima[sets_of_options[i].power] = sets_of_options[i].amount;
+    }
+    ++i;
+  }
+  return 0;
+}
+
+static inline int memorypa_profile_export_write_hex(int fd, size_t number) {
+  char digits[19];
+  char *digit_index = digits + 18;
+  *digit_index = 0;
+  do {
+    *(--digit_index) = "0123456789abcdef"[number & 15];
+  }
+  while((number >>= 4));
+  *(--digit_index) = 'x';
+  *(--digit_index) = '0';
+  return memorypa_profile_export_write(fd, digit_index);
+}
+
+static inline int memorypa_profile_export_write_counts(int fd, size_t count, size_t bytes, size_t total_count, size_t total_bytes) {
+  int failed = memorypa_profile_export_write_decimal(fd, count);
+  failed |= memorypa_profile_export_write(fd, ": ");
+  failed |= memorypa_profile_export_write_decimal(fd, bytes);
+  failed |= memorypa_profile_export_write(fd, " [");
+  failed |= memorypa_profile_export_write_decimal(fd, total_count);
+  failed |= memorypa_profile_export_write(fd, ": ");
+  failed |= memorypa_profile_export_write_decimal(fd, total_bytes);
+  failed |= memorypa_profile_export_write(fd, "]");
+  return failed;
+}
+
+/*
+  With "peak", a site reports the most bytes it ever held instead of what
+  it holds now, and the count of allocations that its average size makes
+  of them. Every site peaks on its own, so these needn't add up to any
+  moment of the program.
+*/
+static inline void memorypa_profile_site_get_counts(size_t *site, unsigned char peak, size_t *count, size_t *bytes) {
+  if(!peak) {
+    *count = memorypa_profile_load(site + 3);
+    *bytes = memorypa_profile_load(site + 4);
+    return;
+  }
+  size_t total_count = memorypa_profile_load(site + 6);
+  size_t total_bytes = memorypa_profile_load(site + 7);
+  *bytes = memorypa_profile_load(site + 5);
+  *count = total_bytes ? ((*bytes / total_bytes) * total_count) + (((*bytes % total_bytes) * total_count) + total_bytes - 1) / total_bytes : 0;
+}
+
+/*
+  Writes the sampled sites of "power" (or of every power if it's 0) as a
+  legacy heap profile, which "pprof" reads and turns into reports, graphs
+  and flame graphs. The sampling rate in the header lets it scale the
+  samples back up to estimates of the real counts and bytes. On Linux,
+  the memory map follows so that the addresses can be symbolized.
+*/
+int memorypa_profile_sites_export(int fd, size_t power, unsigned char peak) {
+  size_t count = 0;
+  size_t bytes = 0;
+  size_t total_count = 0;
+  size_t total_bytes = 0;
+  size_t site_count, site_bytes, depth, i, j;
+  size_t *site;
+  int failed = 0;
+  i = 0;
+  while(memorypa_profile_site_list != NULL && i < MEMORYPA_PROFILE_SITES) {
+    site = memorypa_profile_site_at(i++);
+    if(memorypa_event_load(site) > 1 && (!power || site[1] == power)) {
+      memorypa_profile_site_get_counts(site, peak, &site_count, &site_bytes);
+      count += site_count;
+      bytes += site_bytes;
+      total_count += memorypa_profile_load(site + 6);
+      total_bytes += memorypa_profile_load(site + 7);
+    }
+  }
+  failed |= memorypa_profile_export_write(fd, "heap profile: ");
+  failed |= memorypa_profile_export_write_counts(fd, count, bytes, total_count, total_bytes);
+  failed |= memorypa_profile_export_write(fd, " @ heap_v2/");
+  failed |= memorypa_profile_export_write_decimal(fd, memorypa_profile_sample_rate);
+  failed |= memorypa_profile_export_write(fd, "\n");
+  i = 0;
+  while(memorypa_profile_site_list != NULL && i < MEMORYPA_PROFILE_SITES) {
+    site = memorypa_profile_site_at(i++);
+    if(memorypa_event_load(site) > 1 && (!power || site[1] == power)) {
+      memorypa_profile_site_get_counts(site, peak, &site_count, &site_bytes);
+      failed |= memorypa_profile_export_write_counts(fd, site_count, site_bytes, memorypa_profile_load(site + 6), memorypa_profile_load(site + 7));
+      failed |= memorypa_profile_export_write(fd, " @");
+      depth = site[2];
+      j = 0;
+      while(j < depth) {
+        failed |= memorypa_profile_export_write(fd, " ");
+        failed |= memorypa_profile_export_write_hex(fd, site[8 + j++]);
+      }
+      failed |= memorypa_profile_export_write(fd, "\n");
+    }
+  }
+  #ifdef __linux__
+  failed |= memorypa_profile_export_write(fd, "\nMAPPED_LIBRARIES:\n");
+  int maps = open("/proc/self/maps", O_RDONLY);
+  if(maps < 0) {
+    return -1;
+  }
+  char buffer[MEMORYPA_CONFIG_SIZE];
+  ssize_t amount;
+  while((amount = read(maps, buffer, MEMORYPA_CONFIG_SIZE)) > 0) {
+    if(MEMORYPA_WRITE(fd, buffer, (unsigned int)amount) != amount) {
+      failed = -1;
+    }
+  }
+  close(maps);
+  #endif
+  return failed;
 }
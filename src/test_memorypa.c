@@ -23,6 +23,8 @@
 
 #include "memorypa.h"
 
+static unsigned char memorypa_test_native_alignment = 0;
+
 #ifdef _MSC_VER
 __declspec(dllexport) void memorypa_initializer_options(memorypa_functions *functions, memorypa_pool_options *sets_of_pool_options) {
 #else
@@ -31,16 +33,34 @@ void memorypa_initializer_options(memorypa_functions *functions, memorypa_pool_o
   functions->malloc = malloc;
   functions->realloc = realloc;
   functions->free = free;
+  // Test the size histogram of the profiler!
+  functions->profile_histogram = 1;
+  //
+  // Test sampling call stacks!
+  functions->profile_sample_rate = MEMORYPA_PROFILE_SAMPLE_RATE;
+  //
 #ifdef MEMORYPA_TEST_RESCUE
+  // Test header-less blocks!
+  functions->headerless = 1;
+  //
   if(memorypa_get_size_t_size() > 4) {
     sets_of_pool_options[0].power = 7;
     sets_of_pool_options[0].amount = 500;
     sets_of_pool_options[1].power = 8;
     sets_of_pool_options[1].amount = 200;
+    // Test queue locks!
+    sets_of_pool_options[1].synchronization = MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK;
+    //
     sets_of_pool_options[2].power = 9;
     sets_of_pool_options[2].amount = 200;
+    // Test size classes!
+    sets_of_pool_options[2].steps = 2;
+    //
     sets_of_pool_options[3].power = 10;
     sets_of_pool_options[3].amount = 75;
+    // Test lock-free pools!
+    sets_of_pool_options[3].synchronization = MEMORYPA_SYNCHRONIZATION_LOCK_FREE;
+    //
     sets_of_pool_options[4].power = 11;
     // Test padding!
     sets_of_pool_options[4].padding = 64;
@@ -48,6 +68,9 @@ void memorypa_initializer_options(memorypa_functions *functions, memorypa_pool_o
     sets_of_pool_options[4].amount = 400;
     sets_of_pool_options[5].power = 12;
     sets_of_pool_options[5].amount = 500;
+    // Test intrusive free lists!
+    sets_of_pool_options[5].free_list = MEMORYPA_FREE_LIST_INTRUSIVE;
+    //
   }
   else {
     sets_of_pool_options[0].power = 7;
@@ -65,23 +88,56 @@ void memorypa_initializer_options(memorypa_functions *functions, memorypa_pool_o
     sets_of_pool_options[4].amount = 400;
   }
 #else
+  // Test native alignment!
+  functions->native_alignment = 1;
+  memorypa_test_native_alignment = 1;
+  //
   sets_of_pool_options[0].power = 7;
   sets_of_pool_options[0].amount = 500;
+  // Test thread caches!
+  sets_of_pool_options[0].cache = 32;
+  sets_of_pool_options[0].free_list = MEMORYPA_FREE_LIST_INTRUSIVE;
+  //
   sets_of_pool_options[1].power = 8;
   sets_of_pool_options[1].amount = 200;
+  // Test lock-free pools!
+  sets_of_pool_options[1].synchronization = MEMORYPA_SYNCHRONIZATION_LOCK_FREE;
+  //
   sets_of_pool_options[2].power = 9;
   sets_of_pool_options[2].amount = 200;
+  sets_of_pool_options[2].cache = 5;
+  sets_of_pool_options[2].synchronization = MEMORYPA_SYNCHRONIZATION_LOCK_FREE;
   sets_of_pool_options[3].power = 10;
   sets_of_pool_options[3].amount = 300;
+  // Test queue locks!
+  sets_of_pool_options[3].synchronization = MEMORYPA_SYNCHRONIZATION_QUEUE_LOCK;
+  //
+  // Test per-CPU pools!
+  sets_of_pool_options[3].per_cpu = 1;
+  //
   sets_of_pool_options[4].power = 11;
   // Test padding!
   sets_of_pool_options[4].padding = 64;
   //
   sets_of_pool_options[4].amount = 400;
   sets_of_pool_options[5].power = 12;
-  sets_of_pool_options[5].amount = 500;
+  sets_of_pool_options[5].amount = 100;
+  // Test intrusive free lists!
+  sets_of_pool_options[5].free_list = MEMORYPA_FREE_LIST_INTRUSIVE;
+  sets_of_pool_options[5].prefetch = 1;
+  //
+  // Test growable pools!
+  sets_of_pool_options[5].segments = 4;
+  //
   sets_of_pool_options[6].power = 13;
   sets_of_pool_options[6].amount = 50;
+  // Test exact size classes!
+  sets_of_pool_options[6].steps = 4;
+  sets_of_pool_options[6].exact = 1;
+  //
+  // Test automatic trimming!
+  functions->trim_threshold = 65536;
+  //
 #endif
 }
 
@@ -209,6 +265,299 @@ static unsigned char memorypa_test_check_block(void *block, size_t block_size, s
   return 1;
 }
 
+#ifndef MEMORYPA_TEST_RESCUE
+/*
+  Sizes beyond every pool get mappings of their own, which must keep
+  their data across growing and shrinking.
+*/
+#define MEMORYPA_TEST_MAPPING_SIZE (1024 * 1024)
+
+static void memorypa_test_mappings() {
+  unsigned char *data = (unsigned char *)memorypa_malloc(MEMORYPA_TEST_MAPPING_SIZE);
+  if(data == NULL || memorypa_malloc_usable_size(data) < MEMORYPA_TEST_MAPPING_SIZE) {
+    printf("Mapping test fails to allocate!\n");
+    return;
+  }
+  size_t seed = (size_t)data;
+  memorypa_test_set_block(data, MEMORYPA_TEST_MAPPING_SIZE);
+  data = (unsigned char *)memorypa_realloc(data, MEMORYPA_TEST_MAPPING_SIZE << 4);
+  if(data == NULL || memorypa_malloc_usable_size(data) < (MEMORYPA_TEST_MAPPING_SIZE << 4) || !memorypa_test_check_block(data, MEMORYPA_TEST_MAPPING_SIZE, seed)) {
+    printf("Mapping test fails to grow!\n");
+    return;
+  }
+  data = (unsigned char *)memorypa_realloc(data, MEMORYPA_TEST_MAPPING_SIZE >> 1);
+  if(data == NULL || !memorypa_test_check_block(data, MEMORYPA_TEST_MAPPING_SIZE >> 1, seed)) {
+    printf("Mapping test fails to shrink!\n");
+    return;
+  }
+  memorypa_free(data);
+  data = (unsigned char *)memorypa_aligned_malloc(4096, MEMORYPA_TEST_MAPPING_SIZE);
+  if(data == NULL || ((size_t)data & 4095)) {
+    printf("Mapping test violates alignment!\n");
+  }
+  memorypa_free(data);
+}
+#endif
+
+/*
+  Batches of several sizes, freed with a few foreign pointers mixed in.
+*/
+#define MEMORYPA_TEST_BATCH_SIZE 150
+
+static void memorypa_test_batches() {
+  void *data[MEMORYPA_TEST_BATCH_SIZE];
+  size_t sizes[3] = {100, 1000, 50000};
+  size_t i = 0;
+  size_t j;
+  do {
+    if(memorypa_malloc_batch(sizes[i], MEMORYPA_TEST_BATCH_SIZE, data) != MEMORYPA_TEST_BATCH_SIZE) {
+      printf("Batch test fails to allocate size %zu!\n", sizes[i]);
+      return;
+    }
+    j = 0;
+    do {
+      memorypa_test_set_block(data[j], sizes[i]);
+    }
+    while(++j < MEMORYPA_TEST_BATCH_SIZE);
+    j = 0;
+    do {
+      if(!memorypa_test_check_block(data[j], sizes[i], (size_t)data[j])) {
+        printf("Batch test fails consistency check for size %zu!\n", sizes[i]);
+      }
+    }
+    while(++j < MEMORYPA_TEST_BATCH_SIZE);
+    memorypa_free(data[7]);
+    data[7] = memorypa_malloc(sizes[i] << 1);
+    memorypa_free(data[8]);
+    data[8] = NULL;
+    memorypa_free_batch(data, MEMORYPA_TEST_BATCH_SIZE);
+  }
+  while(++i < 3);
+  // Interleave the sizes so that no two neighbors share a pool:
+  j = 0;
+  do {
+    data[j] = memorypa_malloc(sizes[j % 3]);
+    if(data[j] == NULL) {
+      printf("Batch test fails to allocate interleaved sizes!\n");
+      memorypa_free_batch(data, j);
+      return;
+    }
+    memorypa_test_set_block(data[j], sizes[j % 3]);
+  }
+  while(++j < MEMORYPA_TEST_BATCH_SIZE);
+  j = 0;
+  do {
+    if(!memorypa_test_check_block(data[j], sizes[j % 3], (size_t)data[j])) {
+      printf("Batch test fails consistency check for interleaved sizes!\n");
+    }
+  }
+  while(++j < MEMORYPA_TEST_BATCH_SIZE);
+  memorypa_free_batch(data, MEMORYPA_TEST_BATCH_SIZE);
+  if(memorypa_pools_are_invalid()) {
+    printf("Batch test fails to free interleaved sizes!\n");
+  }
+}
+
+static void memorypa_test_sized() {
+  size_t sizes[4] = {100, 1000, 50000, 1 << 20};
+  size_t i = 0;
+  do {
+    unsigned char *data = (unsigned char *)memorypa_malloc(sizes[i]);
+    if(data == NULL) {
+      printf("Sized test fails to allocate size %zu!\n", sizes[i]);
+      return;
+    }
+    size_t seed = (size_t)data;
+    memorypa_test_set_block(data, sizes[i]);
+    data = (unsigned char *)memorypa_realloc_sized(data, sizes[i], sizes[i] + (sizes[i] >> 1));
+    if(data == NULL || !memorypa_test_check_block(data, sizes[i], seed)) {
+      printf("Sized test fails to grow size %zu!\n", sizes[i]);
+      return;
+    }
+    data = (unsigned char *)memorypa_realloc_sized(data, sizes[i] + (sizes[i] >> 1), sizes[i] >> 2);
+    if(data == NULL || !memorypa_test_check_block(data, sizes[i] >> 2, seed)) {
+      printf("Sized test fails to shrink size %zu!\n", sizes[i]);
+      return;
+    }
+    memorypa_free_sized(data, sizes[i] >> 2);
+  }
+  while(++i < 4);
+  memorypa_free_sized(NULL, 0);
+}
+
+static void memorypa_test_arenas() {
+  unsigned char *data[64];
+  void *arena = memorypa_arena_create(4096);
+  if(arena == NULL) {
+    printf("Arena test fails to create!\n");
+    return;
+  }
+  void *mark = NULL;
+  size_t i = 0;
+  do {
+    if(i == 32) {
+      mark = memorypa_arena_mark(arena);
+    }
+    // Every eighth one outgrows the chunks:
+    data[i] = (unsigned char *)memorypa_arena_aligned_malloc(arena, (size_t)1 << (i & 7), (i & 7) == 7 ? 10000 : 100 + i);
+    if(data[i] == NULL || ((size_t)data[i] & ((1 << (i & 7)) - 1))) {
+      printf("Arena test fails to allocate!\n");
+      memorypa_arena_destroy(arena);
+      return;
+    }
+    memorypa_test_set_block(data[i], 100);
+  }
+  while(++i < 64);
+  memorypa_arena_rewind(arena, mark);
+  i = 32;
+  do {
+    data[i] = (unsigned char *)memorypa_arena_malloc(arena, 200);
+    if(data[i] == NULL) {
+      printf("Arena test fails to allocate after rewinding!\n");
+      memorypa_arena_destroy(arena);
+      return;
+    }
+    memorypa_test_set_block(data[i], 200);
+  }
+  while(++i < 64);
+  i = 0;
+  do {
+    if(!memorypa_test_check_block(data[i], i < 32 ? 100 : 200, (size_t)data[i])) {
+      printf("Arena test fails consistency check!\n");
+    }
+  }
+  while(++i < 64);
+  memorypa_arena_reset(arena);
+  // Fill the kept chunks again, oversized ones included:
+  i = 0;
+  do {
+    data[i] = (unsigned char *)memorypa_arena_malloc(arena, (i & 7) == 7 ? 10000 : 300);
+    if(data[i] == NULL) {
+      printf("Arena test fails to allocate after resetting!\n");
+      memorypa_arena_destroy(arena);
+      return;
+    }
+    memorypa_test_set_block(data[i], 300);
+  }
+  while(++i < 64);
+  i = 0;
+  do {
+    if(!memorypa_test_check_block(data[i], 300, (size_t)data[i])) {
+      printf("Arena test fails consistency check after resetting!\n");
+    }
+  }
+  while(++i < 64);
+  memorypa_arena_destroy(arena);
+}
+
+static void memorypa_test_heaps() {
+  memorypa_pool_options options[sizeof(size_t) * CHAR_BIT];
+  unsigned char *data[20];
+  memset(options, 0, sizeof(options));
+  options[0].power = 8;
+  options[0].amount = 16;
+  options[1].power = 12;
+  options[1].amount = 8;
+  options[1].steps = 2;
+  memorypa_heap_t *heap = memorypa_heap_create(options);
+  if(heap == NULL) {
+    printf("Heap test fails to create!\n");
+    return;
+  }
+  // The options are validated on a copy:
+  if(options[0].steps || options[0].own_size) {
+    printf("Heap test fails to leave the options alone!\n");
+  }
+  // Invalid options are reported and make no heap:
+  options[2].power = 10;
+  if(memorypa_heap_create(options) != NULL) {
+    printf("Heap test fails to reject unordered powers!\n");
+  }
+  options[2].power = 0;
+  options[0].cache = 4;
+  if(memorypa_heap_create(options) != NULL) {
+    printf("Heap test fails to reject thread caches!\n");
+  }
+  options[0].cache = 0;
+  // The last four don't fit the pool and get rescued:
+  size_t i = 0;
+  do {
+    data[i] = (unsigned char *)memorypa_heap_malloc(heap, 100);
+    if(data[i] == NULL) {
+      printf("Heap test fails to allocate!\n");
+      memorypa_heap_destroy(heap);
+      return;
+    }
+    memorypa_test_set_block(data[i], 100);
+  }
+  while(++i < 20);
+  unsigned char *first = data[0];
+  i = 0;
+  do {
+    size_t seed = (size_t)data[i];
+    data[i] = (unsigned char *)memorypa_heap_realloc(heap, data[i], i & 1 ? 3000 : 50);
+    if(data[i] == NULL || !memorypa_test_check_block(data[i], 50, seed)) {
+      printf("Heap test fails to reallocate!\n");
+    }
+  }
+  while(++i < 20);
+  i = 0;
+  do {
+    memorypa_heap_free(heap, data[i]);
+  }
+  while(++i < 20);
+  memorypa_heap_reset(heap);
+  data[0] = (unsigned char *)memorypa_heap_malloc(heap, 100);
+  if(data[0] != first) {
+    printf("Heap test fails to start over after resetting!\n");
+  }
+  memorypa_heap_free(heap, data[0]);
+  memorypa_heap_destroy(heap);
+  // A null heap is the default one:
+  data[0] = (unsigned char *)memorypa_heap_malloc(NULL, 100);
+  memorypa_heap_free(NULL, data[0]);
+}
+
+#ifndef _MSC_VER
+/*
+  Profiled allocations of 16 MiB in all should get about 32 samples at the
+  default rate. The export goes through a pipe that's never waited on.
+*/
+#define MEMORYPA_TEST_SAMPLING_AMOUNT 256
+#define MEMORYPA_TEST_SAMPLING_SIZE (64 * 1024)
+
+static void memorypa_test_sampling() {
+  void *data[MEMORYPA_TEST_SAMPLING_AMOUNT];
+  size_t i = 0;
+  do {
+    data[i] = memorypa_profile_malloc(MEMORYPA_TEST_SAMPLING_SIZE);
+  }
+  while(++i < MEMORYPA_TEST_SAMPLING_AMOUNT);
+  int pipe_ends[2];
+  if(pipe(pipe_ends)) {
+    printf("Sampling test fails to open a pipe!\n");
+    return;
+  }
+  fcntl(pipe_ends[1], F_SETFL, O_NONBLOCK);
+  if(memorypa_profile_sites_export(pipe_ends[1], 0, 0)) {
+    printf("Sampling test fails to export!\n");
+  }
+  char header[32];
+  ssize_t length = read(pipe_ends[0], header, sizeof(header) - 1);
+  header[length > 0 ? length : 0] = 0;
+  if(strncmp(header, "heap profile: ", 14) || header[14] < '1' || header[14] > '9') {
+    printf("Sampling test fails to sample!\n");
+  }
+  close(pipe_ends[0]);
+  close(pipe_ends[1]);
+  i = 0;
+  do {
+    memorypa_profile_free(data[i]);
+  }
+  while(++i < MEMORYPA_TEST_SAMPLING_AMOUNT);
+}
+#endif
+
 static void memorypa_test_allocation(unsigned char id) {
   size_t blocks_size;
   void **blocks;
@@ -282,6 +631,9 @@ static void memorypa_test_allocation(unsigned char id) {
                     ++malloc_failed_count;
                   }
                   else {
+                    if(memorypa_test_native_alignment && ((size_t)(blocks[block_index]) & (MEMORYPA_NATIVE_ALIGNMENT - 1))) {
+                      printf("%u) Block %zu violates native alignment!\n", id, block_index);
+                    }
                     memorypa_test_set_block(blocks[block_index], blocks_sizes[block_index]);
                     ++malloc_count;
                     block_index_size_check = memorypa_test_profile_mode ? memorypa_profile_malloc_usable_size(blocks[block_index]) : memorypa_malloc_usable_size(blocks[block_index]);
@@ -333,6 +685,9 @@ static void memorypa_test_allocation(unsigned char id) {
                     ++calloc_failed_count;
                   }
                   else {
+                    if(memorypa_test_native_alignment && ((size_t)(blocks[block_index]) & (MEMORYPA_NATIVE_ALIGNMENT - 1))) {
+                      printf("%u) Block %zu violates native alignment!\n", id, block_index);
+                    }
                     memorypa_test_set_block(blocks[block_index], blocks_sizes[block_index]);
                     ++calloc_count;
                     block_index_size_check = memorypa_test_profile_mode ? memorypa_profile_malloc_usable_size(blocks[block_index]) : memorypa_malloc_usable_size(blocks[block_index]);
@@ -397,6 +752,9 @@ static void memorypa_test_allocation(unsigned char id) {
                       ++realloc_failed_count;
                     }
                     else {
+                      if(memorypa_test_native_alignment && ((size_t)(blocks[new_block_index]) & (MEMORYPA_NATIVE_ALIGNMENT - 1))) {
+                        printf("%u) Block %zu violates native alignment!\n", id, new_block_index);
+                      }
                       size_t max_size = blocks_sizes[block_index] > blocks_sizes[new_block_index] ? blocks_sizes[new_block_index] : blocks_sizes[block_index];
                       if(test_check && !memorypa_test_check_block(blocks[new_block_index], max_size, (size_t)(blocks[block_index]))) {
                         printf("%u) Block %zu fails consistency check!\n", id, new_block_index);
@@ -482,6 +840,11 @@ static void memorypa_test_allocation(unsigned char id) {
           while(++block_index < blocks_size);
         }
     }
+    // Test trimming!
+    if(!(i & 63)) {
+      memorypa_trim(0);
+    }
+    //
     memorypa_pools_are_invalid();
     j = 0;
     do {
@@ -534,6 +897,26 @@ static void * memorypa_test_first_thread(void * first_thread_data) {
   #endif
 }
 
+/*
+  A thread that destroys the pools while holding a cache, then exits. Its
+  exit must not free the cache a second time.
+*/
+#ifdef _MSC_VER
+static unsigned __stdcall memorypa_test_destroying_thread(void * destroying_thread_data) {
+#else
+static void * memorypa_test_destroying_thread(void * destroying_thread_data) {
+#endif
+  (void)destroying_thread_data;
+  void *data = memorypa_malloc(100);
+  memorypa_free(data);
+  memorypa_destroy();
+  #ifdef _MSC_VER
+  return 0;
+  #else
+  return NULL;
+  #endif
+}
+
 int main(int argc, char const *argv[]) {
   memorypa_initialize();
   size_t_u_char_bit_diff = memorypa_get_size_t_bit_size() - memorypa_get_u_char_bit_size();
@@ -562,12 +945,96 @@ int main(int argc, char const *argv[]) {
   #ifdef _MSC_VER
   CloseHandle((HANDLE)first_thread_handle);
   #endif
+  // Test the event ring!
+  memorypa_event events[4];
+  size_t event_amount = memorypa_events_drain(events, 4);
+  #ifdef MEMORYPA_TEST_RESCUE
+  size_t event_index = 0;
+  if(!event_amount) {
+    printf("Event ring fails to record rescues!\n");
+  }
+  while(event_index < event_amount) {
+    if(events[event_index].kind < MEMORYPA_EVENT_OUT_OF_MEMORY || events[event_index].kind > MEMORYPA_EVENT_RESCUED_REALLOC) {
+      printf("Event %zu fails consistency check!\n", event_index);
+    }
+    ++event_index;
+  }
+  memorypa_events_print();
+  printf("\n");
+  #else
+  if(event_amount) {
+    printf("Event ring fails by recording %zu rescues!\n", event_amount);
+  }
+  #endif
+  //
+  // Test batches!
+  memorypa_test_batches();
+  //
+  // Test sized frees!
+  memorypa_test_sized();
+  //
+  // Test arenas!
+  memorypa_test_arenas();
+  //
+  // Test heaps!
+  memorypa_test_heaps();
+  //
+  #ifndef MEMORYPA_TEST_RESCUE
+  // Test mappings!
+  memorypa_test_mappings();
+  //
+  #endif
   if(memorypa_test_profile_mode) {
+    #ifndef _MSC_VER
+    // Test sampling!
+    memorypa_test_sampling();
+    //
+    #endif
     memorypa_profile_print();
     printf("\n");
+    fflush(stdout);
+    // Test exporting (to the standard output, whose descriptor is 1)!
+    if(memorypa_profile_export(1, MEMORYPA_PROFILE_EXPORT_MAXIMA, 0, 0) || memorypa_profile_export(1, MEMORYPA_PROFILE_EXPORT_CONFIG, 25, 1)) {
+      printf("Profile test fails to export!\n");
+    }
+    // Test merging a profile that doesn't exist!
+    if(memorypa_profile_merge("memorypa_test_missing_profile") != -1) {
+      printf("Profile test fails to report a missing profile!\n");
+    }
+    //
+    printf("\n");
+    //
+  }
+  else {
+    memorypa_pools_print();
+    printf("\n");
   }
   memorypa_test_mhash();
-  memorypa_destroy();
+  // Test destroying from a thread with a cache!
+  #ifdef _MSC_VER
+  uintptr_t destroying_thread_handle = _beginthreadex(NULL, 0, memorypa_test_destroying_thread, NULL, 0, NULL);
+  if(!destroying_thread_handle || WaitForSingleObject((HANDLE)destroying_thread_handle, INFINITE) != WAIT_OBJECT_0) {
+  #else
+  pthread_t destroying_thread_handle;
+  if(pthread_create(&destroying_thread_handle, NULL, memorypa_test_destroying_thread, NULL) || pthread_join(destroying_thread_handle, NULL)) {
+  #endif
+    fprintf(stderr, "Failed to run the destroying thread!\n");
+    exit(EXIT_FAILURE);
+  }
+  //
+  // Test initializing again on the thread that initialized first!
+  if(!memorypa_initialize()) {
+    printf("Initialization fails after destroying!\n");
+  }
+  else {
+    void *data = memorypa_malloc(100);
+    if(data == NULL || memorypa_pools_are_invalid()) {
+      printf("Initialization fails to bring the pools back!\n");
+    }
+    memorypa_free(data);
+    memorypa_destroy();
+  }
+  //
   printf("Done!\n\n");
   return 0;
 }